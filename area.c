@@ -0,0 +1,635 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+
+/*  An AREA is one or more rings of vertices.  Points are tested with the even-odd rule so a ring inside another ring is  */
+/*  a hole.  For the point in polygon test the area is cut into horizontal slabs at every distinct vertex latitude.  No  */
+/*  vertex falls inside a slab so, as long as the rings don't cross each other, the edges that cross a slab keep the  */
+/*  same left to right order all the way across it.  Finding the slab and then the number of edges to the left of the  */
+/*  point are both binary searches.  Shoreline areas sometimes do cross themselves so the order is checked at the top  */
+/*  and bottom of every slab and if any two edges swap places we use the edge by edge test instead.  */
+
+
+/*  Don't let the slab index get silly for pathological areas, fall back to the edge by edge test instead.  */
+
+#define MAX_SLAB_EDGES    50000000
+
+
+/*  Rounding slop (in degrees) allowed when checking that edges that meet at a vertex haven't swapped places.  */
+
+#define SLAB_TOLERANCE    1.0e-9
+
+
+static uint8_t area_grow (AREA *area)
+{
+  double         *x, *y;
+  int32_t        max_count;
+
+
+  if (area->count == area->max_count)
+    {
+      max_count = area->max_count ? area->max_count * 2 : 256;
+
+
+      /*  Keep the old arrays in the area if either realloc fails so free_area still frees them.  */
+
+      if ((x = (double *) realloc (area->x, max_count * sizeof (double))) == NULL) return (NVFalse);
+      area->x = x;
+
+      if ((y = (double *) realloc (area->y, max_count * sizeof (double))) == NULL) return (NVFalse);
+      area->y = y;
+
+      area->max_count = max_count;
+    }
+
+  return (NVTrue);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        add_area_point                                      *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Add a vertex to the current ring of an area.        *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t add_area_point (AREA *area, double lon, double lat)
+{
+  if (!area_grow (area)) return (NVFalse);
+
+  if (!area->ring_count)
+    {
+      area->ring_start[0] = 0;
+      area->ring_count = 1;
+    }
+
+  area->x[area->count] = lon;
+  area->y[area->count] = lat;
+
+  if (!area->count)
+    {
+      area->mbr.min_x = area->mbr.max_x = lon;
+      area->mbr.min_y = area->mbr.max_y = lat;
+    }
+  else
+    {
+      if (lon < area->mbr.min_x) area->mbr.min_x = lon;
+      if (lon > area->mbr.max_x) area->mbr.max_x = lon;
+      if (lat < area->mbr.min_y) area->mbr.min_y = lat;
+      if (lat > area->mbr.max_y) area->mbr.max_y = lat;
+    }
+
+  area->count++;
+  area->ring_start[area->ring_count] = area->count;
+
+  return (NVTrue);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        new_area_ring                                       *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Finish the current ring and start a new one.  A     *
+*                       ring with fewer than 3 vertices is thrown away and  *
+*                       counted in dropped_rings so the caller can report   *
+*                       it.                                                 *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t new_area_ring (AREA *area)
+{
+  int32_t        size, max_rings, *ring_start;
+
+
+  if (!area->ring_count) return (NVTrue);
+
+  size = area->ring_start[area->ring_count] - area->ring_start[area->ring_count - 1];
+
+  if (!size) return (NVTrue);
+
+  if (size < 3)
+    {
+      area->count = area->ring_start[area->ring_count - 1];
+      area->ring_start[area->ring_count] = area->count;
+      area->dropped_rings++;
+      return (NVTrue);
+    }
+
+  if (area->ring_count + 1 >= area->max_rings)
+    {
+      max_rings = area->max_rings ? area->max_rings * 2 : 16;
+      if ((ring_start = (int32_t *) realloc (area->ring_start, (max_rings + 1) * sizeof (int32_t))) == NULL) return (NVFalse);
+
+      area->ring_start = ring_start;
+      area->max_rings = max_rings;
+    }
+
+  area->ring_count++;
+  area->ring_start[area->ring_count] = area->count;
+
+  return (NVTrue);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        init_area                                           *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t init_area (AREA *area)
+{
+  memset (area, 0, sizeof (AREA));
+
+  area->max_rings = 16;
+  if ((area->ring_start = (int32_t *) calloc (area->max_rings + 1, sizeof (int32_t))) == NULL) return (NVFalse);
+
+  return (NVTrue);
+}
+
+
+
+void free_area (AREA *area)
+{
+  free (area->x);
+  free (area->y);
+  free (area->ring_start);
+  free (area->slab_y);
+  free (area->slab_offset);
+  free (area->slab_edge);
+  free (area->next);
+  release_memory (area->index_memory);
+
+  memset (area, 0, sizeof (AREA));
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        close_area                                          *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Finish the last ring of an area.  Returns NVFalse   *
+*                       if the area doesn't have any usable rings.          *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t close_area (AREA *area)
+{
+  if (!new_area_ring (area)) return (NVFalse);
+
+  if (area->ring_count && area->ring_start[area->ring_count] == area->ring_start[area->ring_count - 1]) area->ring_count--;
+
+  return (area->ring_count > 0);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        read_area                                           *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Read an area file with no limit on the number of    *
+*                       vertices.  Generic (.are) files are "lat, lon" per  *
+*                       line, Army Corps (.afs) files are "lon, lat", and   *
+*                       ISS60 (.ARE) files have "POINT=lat;lon;" lines.  A  *
+*                       line starting with RING starts a new ring, blank    *
+*                       lines are ignored.  Rings with fewer than 3         *
+*                       vertices are reported and ignored.                  *
+*                                                                           *
+*   Arguments:          path           - area file name                     *
+*                       area           - returned area                      *
+*                                                                           *
+*   Returns:            NVTrue on success                                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t read_area (char *path, AREA *area)
+{
+  FILE           *fp;
+  char           string[256], first[128], second[128], *ptr;
+  double         lat, lon;
+  int32_t        len;
+  uint8_t        afs, iss60, status, failed = NVFalse;
+
+
+  if (!init_area (area)) return (NVFalse);
+
+  len = strlen (path);
+
+  afs = (len > 4 && !strcmp (&path[len - 4], ".afs"));
+  iss60 = (len > 4 && !strcmp (&path[len - 4], ".ARE"));
+
+  if ((fp = fopen (path, "r")) == NULL)
+    {
+      perror (path);
+      return (NVFalse);
+    }
+
+  while (fgets (string, sizeof (string), fp) != NULL)
+    {
+      ptr = string;
+      while (*ptr == ' ' || *ptr == '\t') ptr++;
+
+      if (*ptr == '\n' || *ptr == '\r' || !*ptr) continue;
+
+      if (!strncmp (ptr, "RING", 4))
+        {
+          if (!new_area_ring (area))
+            {
+              failed = NVTrue;
+              break;
+            }
+          continue;
+        }
+
+      if (iss60)
+        {
+          if (strncmp (ptr, "POINT=", 6) || sscanf (ptr + 6, "%127[^;];%127[^;\n\r]", first, second) != 2) continue;
+
+          posfix (first, &lat, POS_LAT);
+          posfix (second, &lon, POS_LON);
+        }
+      else
+        {
+          if (sscanf (ptr, "%127[^,],%127[^\n\r]", first, second) != 2) continue;
+
+          if (afs)
+            {
+              posfix (first, &lon, POS_LON);
+              posfix (second, &lat, POS_LAT);
+            }
+          else
+            {
+              posfix (first, &lat, POS_LAT);
+              posfix (second, &lon, POS_LON);
+            }
+        }
+
+      if (!add_area_point (area, lon, lat))
+        {
+          failed = NVTrue;
+          break;
+        }
+    }
+
+  fclose (fp);
+
+
+  /*  Never use part of an area.  */
+
+  if (failed)
+    {
+      fprintf (stderr, "\n\nOut of memory reading the area file %s\n\n", path);
+      return (NVFalse);
+    }
+
+  status = close_area (area);
+
+  if (area->dropped_rings)
+    {
+      fprintf (stderr, "%d ring(s) in %s had fewer than 3 points and were ignored\n", area->dropped_rings, path);
+      fflush (stderr);
+    }
+
+  return (status);
+}
+
+
+
+/*  X of the edge from vertex "edge" to vertex "next" at latitude y.  */
+
+static double edge_x (AREA *area, int32_t edge, int32_t next, double y)
+{
+  if (area->y[next] == area->y[edge]) return (area->x[edge]);
+
+  return (area->x[edge] + (area->x[next] - area->x[edge]) * (y - area->y[edge]) / (area->y[next] - area->y[edge]));
+}
+
+
+
+static int32_t compare_doubles (const void *a, const void *b)
+{
+  double da = *(const double *) a, db = *(const double *) b;
+
+  if (da < db) return (-1);
+  if (da > db) return (1);
+  return (0);
+}
+
+
+
+/*  Index of the slab that contains y, i.e. slab_y[s] <= y < slab_y[s + 1].  */
+
+static int32_t find_slab (AREA *area, double y)
+{
+  int32_t        low = 0, high = area->slab_count - 1, mid;
+
+
+  while (low < high)
+    {
+      mid = (low + high + 1) / 2;
+      if (area->slab_y[mid] <= y) low = mid;
+      else high = mid - 1;
+    }
+
+  return (low);
+}
+
+
+
+/*  First and last slab crossed by the edge from vertex "edge" to vertex "next".  */
+
+static void edge_slabs (AREA *area, int32_t edge, int32_t next, int32_t *first, int32_t *last)
+{
+  double         low, high;
+
+
+  low = area->y[edge] < area->y[next] ? area->y[edge] : area->y[next];
+  high = area->y[edge] < area->y[next] ? area->y[next] : area->y[edge];
+
+  *first = find_slab (area, low);
+  *last = find_slab (area, high);
+  if (area->slab_y[*last] == high) (*last)--;
+}
+
+
+
+/*  Used by qsort to put the edges in a slab in left to right order.  */
+
+static AREA    *sort_area;
+static double  sort_y;
+static pthread_mutex_t sort_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int32_t compare_edges (const void *a, const void *b)
+{
+  int32_t ea = *(const int32_t *) a, eb = *(const int32_t *) b;
+  double xa = edge_x (sort_area, ea, sort_area->next[ea], sort_y), xb = edge_x (sort_area, eb, sort_area->next[eb], sort_y);
+
+  if (xa < xb) return (-1);
+  if (xa > xb) return (1);
+  return (0);
+}
+
+
+
+/*  Returns NVTrue if edge "left" is to the right of edge "right" at latitude y.  */
+
+static uint8_t crossed (AREA *area, int32_t left, int32_t right, double y)
+{
+  return (edge_x (area, left, area->next[left], y) > edge_x (area, right, area->next[right], y) + SLAB_TOLERANCE);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        build_area_index                                    *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Build the y-slab index used by inside_area.  If     *
+*                       the index would be too big (or doesn't fit in the   *
+*                       memory budget) or the rings cross each other        *
+*                       nothing is built and inside_area tests every edge.  *
+*                                                                           *
+\***************************************************************************/
+
+void build_area_index (AREA *area)
+{
+  int32_t        i, j, ring, next, first, last, *fill = NULL;
+  int64_t        total, bytes;
+
+
+  if (!area->count) return;
+
+
+  /*  The next vertex and sorted latitude arrays.  */
+
+  bytes = (int64_t) area->count * (sizeof (int32_t) + sizeof (double));
+  if (!reserve_memory (bytes, NVFalse)) return;
+  area->index_memory = bytes;
+
+
+  /*  Next vertex for each edge.  The last vertex of a ring connects back to the first.  */
+
+  if ((area->next = (int32_t *) malloc (area->count * sizeof (int32_t))) == NULL) goto FAILED;
+
+  for (ring = 0 ; ring < area->ring_count ; ring++)
+    {
+      if (area->ring_start[ring + 1] == area->ring_start[ring]) continue;
+
+      for (i = area->ring_start[ring] ; i < area->ring_start[ring + 1] ; i++) area->next[i] = i + 1;
+      area->next[area->ring_start[ring + 1] - 1] = area->ring_start[ring];
+    }
+
+
+  /*  Distinct vertex latitudes are the slab boundaries.  */
+
+  if ((area->slab_y = (double *) malloc (area->count * sizeof (double))) == NULL) goto FAILED;
+  memcpy (area->slab_y, area->y, area->count * sizeof (double));
+  qsort (area->slab_y, area->count, sizeof (double), compare_doubles);
+
+  for (i = 1, j = 0 ; i < area->count ; i++)
+    {
+      if (area->slab_y[i] != area->slab_y[j]) area->slab_y[++j] = area->slab_y[i];
+    }
+
+  area->slab_count = j;
+  if (area->slab_count < 1) goto FAILED;
+
+
+  /*  Slab offsets and the fill counts used while building.  */
+
+  bytes = (int64_t) (2 * area->slab_count + 1) * sizeof (int32_t);
+  if (!reserve_memory (bytes, NVFalse)) goto FAILED;
+  area->index_memory += bytes;
+
+  area->slab_offset = (int32_t *) calloc (area->slab_count + 1, sizeof (int32_t));
+  fill = (int32_t *) calloc (area->slab_count, sizeof (int32_t));
+  if (area->slab_offset == NULL || fill == NULL) goto FAILED;
+
+
+  /*  Count the edges crossing each slab.  Horizontal edges don't cross any.  */
+
+  total = 0;
+  for (ring = 0 ; ring < area->ring_count ; ring++)
+    {
+      for (i = area->ring_start[ring] ; i < area->ring_start[ring + 1] ; i++)
+        {
+          next = area->next[i];
+
+          if (area->y[i] == area->y[next]) continue;
+
+          edge_slabs (area, i, next, &first, &last);
+
+          for (j = first ; j <= last ; j++) area->slab_offset[j + 1]++;
+          total += last - first + 1;
+        }
+    }
+
+  if (total > MAX_SLAB_EDGES || !reserve_memory (total * sizeof (int32_t), NVFalse)) goto FAILED;
+
+  area->index_memory += total * sizeof (int32_t);
+
+  for (j = 0 ; j < area->slab_count ; j++) area->slab_offset[j + 1] += area->slab_offset[j];
+
+  if ((area->slab_edge = (int32_t *) malloc ((total ? total : 1) * sizeof (int32_t))) == NULL) goto FAILED;
+
+  for (ring = 0 ; ring < area->ring_count ; ring++)
+    {
+      for (i = area->ring_start[ring] ; i < area->ring_start[ring + 1] ; i++)
+        {
+          next = area->next[i];
+
+          if (area->y[i] == area->y[next]) continue;
+
+          edge_slabs (area, i, next, &first, &last);
+
+          for (j = first ; j <= last ; j++) area->slab_edge[area->slab_offset[j] + fill[j]++] = i;
+        }
+    }
+
+
+  /*  Sort each slab's edges left to right at the middle of the slab.  */
+
+  pthread_mutex_lock (&sort_mutex);
+  sort_area = area;
+  for (j = 0 ; j < area->slab_count ; j++)
+    {
+      sort_y = (area->slab_y[j] + area->slab_y[j + 1]) * 0.5;
+      qsort (&area->slab_edge[area->slab_offset[j]], area->slab_offset[j + 1] - area->slab_offset[j], sizeof (int32_t), compare_edges);
+    }
+  pthread_mutex_unlock (&sort_mutex);
+
+
+  /*  Make sure no two edges cross inside a slab.  */
+
+  for (j = 0 ; j < area->slab_count ; j++)
+    {
+      for (i = area->slab_offset[j] + 1 ; i < area->slab_offset[j + 1] ; i++)
+        {
+          if (crossed (area, area->slab_edge[i - 1], area->slab_edge[i], area->slab_y[j]) ||
+              crossed (area, area->slab_edge[i - 1], area->slab_edge[i], area->slab_y[j + 1])) goto FAILED;
+        }
+    }
+
+  free (fill);
+  release_memory ((int64_t) area->slab_count * sizeof (int32_t));
+  area->index_memory -= (int64_t) area->slab_count * sizeof (int32_t);
+  return;
+
+
+ FAILED:
+
+  release_memory (area->index_memory);
+  free (fill);
+  free (area->next);
+  free (area->slab_y);
+  free (area->slab_offset);
+  free (area->slab_edge);
+  area->next = NULL;
+  area->slab_y = NULL;
+  area->slab_offset = NULL;
+  area->slab_edge = NULL;
+  area->slab_count = 0;
+  area->index_memory = 0;
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        inside_area                                         *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Even-odd point in area test.  Uses the slab index   *
+*                       if there is one (O(log n)) otherwise checks every   *
+*                       edge of every ring.                                 *
+*                                                                           *
+*   Arguments:          area           - the area                           *
+*                       x              - longitude                          *
+*                       y              - latitude                           *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t inside_area (AREA *area, double x, double y)
+{
+  int32_t        i, ring, slab, low, high, mid, next;
+  uint8_t        inside;
+
+
+  if (x < area->mbr.min_x || x > area->mbr.max_x || y < area->mbr.min_y || y >= area->mbr.max_y) return (NVFalse);
+
+
+  if (area->slab_count)
+    {
+      slab = find_slab (area, y);
+
+
+      /*  Count the edges in this slab that are left of the point.  */
+
+      low = area->slab_offset[slab];
+      high = area->slab_offset[slab + 1];
+      while (low < high)
+        {
+          mid = (low + high) / 2;
+          if (edge_x (area, area->slab_edge[mid], area->next[area->slab_edge[mid]], y) < x) low = mid + 1;
+          else high = mid;
+        }
+
+      return ((low - area->slab_offset[slab]) & 1);
+    }
+
+
+  inside = NVFalse;
+  for (ring = 0 ; ring < area->ring_count ; ring++)
+    {
+      for (i = area->ring_start[ring] ; i < area->ring_start[ring + 1] ; i++)
+        {
+          next = (i == area->ring_start[ring + 1] - 1) ? area->ring_start[ring] : i + 1;
+
+          if ((area->y[i] > y) != (area->y[next] > y) && x < edge_x (area, i, next, y)) inside = !inside;
+        }
+    }
+
+  return (inside);
+}
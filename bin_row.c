@@ -0,0 +1,100 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        read_bin_run                                        *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Read the bin records for a run of bins in one row   *
+*                       of the PFM with a single read_bin_row call into a   *
+*                       reusable buffer.  The buffer only grows.  If it     *
+*                       would go over the memory budget fewer bins are      *
+*                       read and buffer->width is set to the number of      *
+*                       bins that were actually read.                       *
+*                                                                           *
+*   Arguments:          hnd            - PFM handle                         *
+*                       row            - bin row                            *
+*                       column         - first bin column                   *
+*                       width          - number of bins                     *
+*                       buffer         - bin buffer (zero it before the     *
+*                                        first call, free_bin_buffer when   *
+*                                        done)                              *
+*                                                                           *
+*   Returns:            Number of bins read or -1 on error                  *
+*                                                                           *
+\***************************************************************************/
+
+int32_t read_bin_run (int32_t hnd, int32_t row, int32_t column, int32_t width, BIN_BUFFER *buffer)
+{
+  BIN_RECORD     *bins;
+
+
+  buffer->width = 0;
+
+  if (width <= 0) return (0);
+
+
+  /*  If there isn't room in the budget for the whole run of bins, use what we've already got or, the first time,  */
+  /*  whatever fits.  */
+
+  if (width > buffer->max_bins && !reserve_memory ((int64_t) (width - buffer->max_bins) * sizeof (BIN_RECORD), NVFalse))
+    {
+      if (buffer->max_bins)
+        {
+          width = buffer->max_bins;
+        }
+      else
+        {
+          while (width > 1 && !reserve_memory ((int64_t) width * sizeof (BIN_RECORD), NVFalse)) width /= 2;
+          if (width == 1) reserve_memory (sizeof (BIN_RECORD), NVTrue);
+        }
+    }
+
+  if (width > buffer->max_bins)
+    {
+      buffer->reserved += (int64_t) (width - buffer->max_bins) * sizeof (BIN_RECORD);
+      buffer->max_bins = width;
+      if ((bins = (BIN_RECORD *) realloc (buffer->bins, width * sizeof (BIN_RECORD))) == NULL) return (-1);
+      buffer->bins = bins;
+    }
+
+  if (read_bin_row (hnd, width, row, column, buffer->bins)) return (-1);
+
+  buffer->width = width;
+
+  return (width);
+}
+
+
+
+void free_bin_buffer (BIN_BUFFER *buffer)
+{
+  free (buffer->bins);
+  release_memory (buffer->reserved);
+  memset (buffer, 0, sizeof (BIN_BUFFER));
+}
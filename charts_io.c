@@ -0,0 +1,134 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+
+/*  The CHARTS HOF and INH readers aren't thread safe.  They keep what they learned from the header of the file they  */
+/*  were last used on (the byte order and, for INH files, the waveform sizes) in static variables.  When queries run  */
+/*  concurrently get_waveforms is called from several threads at once, so every call into those readers goes through  */
+/*  here.  The calls are made one at a time under charts_mutex and if the library was last used on a different file  */
+/*  we read this file's header again first so that its static state is for the right file.  With a single thread  */
+/*  that never happens.  Files opened here must be closed with charts_close so a new file that happens to get the  */
+/*  same FILE pointer isn't mistaken for the old one.  */
+
+static pthread_mutex_t charts_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE            *hof_current = NULL, *wave_current = NULL;
+
+
+
+FILE *charts_open_hof (char *path)
+{
+  FILE           *fp;
+
+
+  pthread_mutex_lock (&charts_mutex);
+
+  if ((fp = open_hof_file (path)) != NULL) hof_current = fp;
+
+  pthread_mutex_unlock (&charts_mutex);
+
+  return (fp);
+}
+
+
+
+uint8_t charts_read_hof (FILE *fp, int32_t rec, HYDRO_OUTPUT_T *hof)
+{
+  HOF_HEADER_T   head;
+  uint8_t        status;
+
+
+  pthread_mutex_lock (&charts_mutex);
+
+  if (fp != hof_current)
+    {
+      hof_read_header (fp, &head);
+      hof_current = fp;
+    }
+
+  status = hof_read_record (fp, rec, hof);
+
+  pthread_mutex_unlock (&charts_mutex);
+
+  return (status);
+}
+
+
+
+/*  Open an INH file and read its header.  */
+
+FILE *charts_open_wave (char *path, WAVE_HEADER_T *header)
+{
+  FILE           *fp;
+
+
+  pthread_mutex_lock (&charts_mutex);
+
+  if ((fp = open_wave_file (path)) != NULL)
+    {
+      wave_read_header (fp, header);
+      wave_current = fp;
+    }
+
+  pthread_mutex_unlock (&charts_mutex);
+
+  return (fp);
+}
+
+
+
+uint8_t charts_read_wave (FILE *fp, int32_t rec, WAVE_DATA_T *data)
+{
+  WAVE_HEADER_T  header;
+  uint8_t        status;
+
+
+  pthread_mutex_lock (&charts_mutex);
+
+  if (fp != wave_current)
+    {
+      wave_read_header (fp, &header);
+      wave_current = fp;
+    }
+
+  status = wave_read_record (fp, rec, data);
+
+  pthread_mutex_unlock (&charts_mutex);
+
+  return (status);
+}
+
+
+
+void charts_close (FILE *fp)
+{
+  pthread_mutex_lock (&charts_mutex);
+
+  if (fp == hof_current) hof_current = NULL;
+  if (fp == wave_current) wave_current = NULL;
+
+  fclose (fp);
+
+  pthread_mutex_unlock (&charts_mutex);
+}
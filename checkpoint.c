@@ -0,0 +1,356 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+#include <time.h>
+
+#ifdef NVWIN3X
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+
+/*  Checkpoints let a long extraction that died part way through (a node being preempted, too many pos/sbet  */
+/*  mismatches) pick up where it left off.  They are only kept when the run is started with --resume.  Files are  */
+/*  extracted one at a time in plan order, so after a file is done (and at least CHECKPOINT_SECONDS after the last  */
+/*  checkpoint) we flush the output to disk and record how many plan items are done, where the output ends, a digest  */
+/*  of the output up to there, and the counters.  On --resume the output is cut back to that point, the finished files  */
+/*  are skipped, and the counters are put back so that the end result is byte for byte the same as an uninterrupted  */
+/*  run.  The checkpoint is only used if the run's query_digest and a digest of the extraction plan match and the  */
+/*  output still holds exactly what the checkpoint says it does, otherwise we start over.  */
+
+#define CHECKPOINT_MAGIC      "PWCKPT02"
+#define CHECKPOINT_SECONDS    30
+#define CHECKPOINT_BUFFER     65536
+
+
+typedef struct
+{
+  char          magic[8];
+  uint64_t      key;                      /*  query_digest of the run  */
+  uint64_t      plan;                     /*  Digest of the extraction plan  */
+  int64_t       offset;                   /*  End of the output after the last finished file  */
+  uint64_t      digest;                   /*  Digest of the output up to offset  */
+  int32_t       done;                     /*  Number of finished plan items  */
+  int32_t       icount;
+  int32_t       count;
+  int32_t       good_count;
+  int32_t       bad_count;
+  int32_t       segment_count;
+} CHECKPOINT_HEADER;
+
+
+
+static uint64_t plan_digest (PREFETCH_ITEM *plan, int32_t plan_count)
+{
+  uint64_t       hash = FNV_OFFSET;
+  int32_t        i;
+
+
+  for (i = 0 ; i < plan_count ; i++)
+    {
+      hash = fnv (hash, &plan[i].file_number, sizeof (int32_t));
+      hash = fnv (hash, &plan[i].range_count, sizeof (int32_t));
+      hash = fnv (hash, plan[i].ranges, plan[i].range_count * sizeof (PING_RANGE));
+    }
+
+  return (hash);
+}
+
+
+
+/*  Add bytes start to end of the output to a digest.  The caller has to flush the output first and seek back to  */
+/*  wherever it wants to write next.  */
+
+static uint8_t digest_output (FILE *fp, int64_t start, int64_t end, uint64_t *hash)
+{
+  uint8_t        *buffer;
+  size_t         length;
+  uint8_t        status = NVTrue;
+
+
+  if (end <= start) return (NVTrue);
+
+  if ((buffer = (uint8_t *) malloc (CHECKPOINT_BUFFER)) == NULL || fseeko (fp, start, SEEK_SET))
+    {
+      free (buffer);
+      return (NVFalse);
+    }
+
+  while (start < end)
+    {
+      length = end - start < CHECKPOINT_BUFFER ? (size_t) (end - start) : CHECKPOINT_BUFFER;
+
+      if (fread (buffer, 1, length, fp) != length)
+        {
+          status = NVFalse;
+          break;
+        }
+
+      *hash = fnv (*hash, buffer, length);
+      start += length;
+    }
+
+  free (buffer);
+
+  return (status);
+}
+
+
+
+/*  Cut the output file back to offset and position it there for writing.  */
+
+static uint8_t truncate_output (FILE *fp, int64_t offset)
+{
+  fflush (fp);
+
+#ifdef NVWIN3X
+  if (_chsize_s (_fileno (fp), offset)) return (NVFalse);
+#else
+  if (ftruncate (fileno (fp), (off_t) offset)) return (NVFalse);
+#endif
+
+  return (!fseeko (fp, offset, SEEK_SET));
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        resume_checkpoint                                   *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Pick up an interrupted run from its checkpoint.     *
+*                       The output (opened for update) is cut back to the   *
+*                       end of the last finished file and the query         *
+*                       counters are restored.  If there is no usable       *
+*                       checkpoint, or the output is shorter than the       *
+*                       checkpoint or doesn't match its digest, the output  *
+*                       is emptied and we start over.                       *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                       plan           - the extraction plan                *
+*                       plan_count     - number of plan items               *
+*                       icount         - returned waveform count so far     *
+*                                                                           *
+*   Returns:            Number of plan items already done or -1 on error    *
+*                                                                           *
+\***************************************************************************/
+
+int32_t resume_checkpoint (QUERY *query, PREFETCH_ITEM *plan, int32_t plan_count, int32_t *icount)
+{
+  FILE               *fp;
+  CHECKPOINT_HEADER  head;
+  struct stat        txt_stat;
+  uint64_t           hash = FNV_OFFSET;
+  uint8_t            usable = NVFalse;
+
+
+  *icount = 0;
+
+  query->checkpoint_digest = FNV_OFFSET;
+  query->checkpoint_offset = 0;
+  query->checkpoint_time = (int64_t) time (NULL);
+
+  if ((fp = fopen (query->checkpoint_file, "rb")) != NULL)
+    {
+      usable = (fread (&head, sizeof (CHECKPOINT_HEADER), 1, fp) == 1 && !memcmp (head.magic, CHECKPOINT_MAGIC, 8) &&
+                head.key == query->checkpoint_key && head.plan == plan_digest (plan, plan_count) &&
+                head.done >= 0 && head.done <= plan_count);
+
+      if (usable && head.segment_count)
+        usable = (query->segments != NULL && head.segment_count <= MAX_PFM_FILES &&
+                  fread (query->segments, sizeof (SEGMENT), head.segment_count, fp) == (size_t) head.segment_count);
+
+      fclose (fp);
+    }
+
+
+  /*  The output has to still be there and hold what it did when the checkpoint was written (a deleted or replaced  */
+  /*  output would otherwise be padded with zeros up to the checkpoint).  */
+
+  if (usable)
+    usable = (!fstat (fileno (query->txt_fp), &txt_stat) && (int64_t) txt_stat.st_size >= head.offset &&
+              digest_output (query->txt_fp, 0, head.offset, &hash) && hash == head.digest);
+
+  if (!usable)
+    {
+      if (query->progress)
+        {
+          fprintf (stderr, "No usable checkpoint in %s, starting from the beginning\n", query->checkpoint_file);
+          fflush (stderr);
+        }
+
+      if (!truncate_output (query->txt_fp, 0))
+        {
+          perror ("Truncating output");
+          return (-1);
+        }
+
+      return (0);
+    }
+
+  if (!truncate_output (query->txt_fp, head.offset))
+    {
+      perror ("Truncating output");
+      return (-1);
+    }
+
+  *icount = head.icount;
+  query->checkpoint_digest = head.digest;
+  query->checkpoint_offset = head.offset;
+  query->count = head.count;
+  query->good_count = head.good_count;
+  query->bad_count = head.bad_count;
+  query->segment_count = head.segment_count;
+
+  if (query->progress)
+    {
+      fprintf (stderr, "Resuming after %d of %d files (%d waveforms)\n", head.done, plan_count, head.icount);
+      fflush (stderr);
+    }
+
+  return (head.done);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        write_checkpoint                                    *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Flush the output to disk and record how far we've   *
+*                       gotten.  Does nothing if the last checkpoint was    *
+*                       less than CHECKPOINT_SECONDS ago.                   *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                       plan           - the extraction plan                *
+*                       plan_count     - number of plan items               *
+*                       done           - number of finished plan items      *
+*                       icount         - waveform count so far              *
+*                                                                           *
+*   Returns:            NVFalse on error                                    *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t write_checkpoint (QUERY *query, PREFETCH_ITEM *plan, int32_t plan_count, int32_t done, int32_t icount)
+{
+  FILE               *fp;
+  CHECKPOINT_HEADER  head;
+  char               tmp_file[528];
+  int64_t            offset;
+  uint64_t           hash;
+
+
+  if ((int64_t) time (NULL) - query->checkpoint_time < CHECKPOINT_SECONDS) return (NVTrue);
+
+
+  /*  The output has to be on disk before the checkpoint that points past it.  */
+
+  if (fflush (query->txt_fp)) return (NVFalse);
+
+#ifdef NVWIN3X
+  _commit (_fileno (query->txt_fp));
+#else
+  fsync (fileno (query->txt_fp));
+#endif
+
+
+  /*  Add what was written since the last checkpoint to the output digest and go back to the end.  */
+
+  offset = ftello (query->txt_fp);
+  hash = query->checkpoint_digest;
+
+  if (!digest_output (query->txt_fp, query->checkpoint_offset, offset, &hash) || fseeko (query->txt_fp, offset, SEEK_SET))
+    return (NVFalse);
+
+  query->checkpoint_digest = hash;
+  query->checkpoint_offset = offset;
+  query->checkpoint_time = (int64_t) time (NULL);
+
+  memset (&head, 0, sizeof (CHECKPOINT_HEADER));
+  memcpy (head.magic, CHECKPOINT_MAGIC, 8);
+  head.key = query->checkpoint_key;
+  head.plan = plan_digest (plan, plan_count);
+  head.offset = offset;
+  head.digest = query->checkpoint_digest;
+  head.done = done;
+  head.icount = icount;
+  head.count = query->count;
+  head.good_count = query->good_count;
+  head.bad_count = query->bad_count;
+  head.segment_count = query->segments != NULL ? query->segment_count : 0;
+
+  sprintf (tmp_file, "%s.tmp", query->checkpoint_file);
+
+  if ((fp = fopen (tmp_file, "wb")) == NULL) return (NVFalse);
+
+  if (fwrite (&head, sizeof (CHECKPOINT_HEADER), 1, fp) != 1 ||
+      (head.segment_count && fwrite (query->segments, sizeof (SEGMENT), head.segment_count, fp) != (size_t) head.segment_count))
+    {
+      fclose (fp);
+      remove (tmp_file);
+      return (NVFalse);
+    }
+
+  /*  And the checkpoint has to be on disk before it replaces the old one.  */
+
+  if (fflush (fp))
+    {
+      fclose (fp);
+      remove (tmp_file);
+      return (NVFalse);
+    }
+
+#ifdef NVWIN3X
+  _commit (_fileno (fp));
+#else
+  fsync (fileno (fp));
+#endif
+
+  if (fclose (fp))
+    {
+      remove (tmp_file);
+      return (NVFalse);
+    }
+
+
+  /*  Windows won't rename over an existing file.  */
+
+#ifdef NVWIN3X
+  remove (query->checkpoint_file);
+#endif
+
+  if (rename (tmp_file, query->checkpoint_file))
+    {
+      remove (tmp_file);
+      return (NVFalse);
+    }
+
+  return (NVTrue);
+}
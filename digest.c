@@ -0,0 +1,89 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+#include "version.h"
+
+
+/*  Digests used to tell whether the inputs or outputs of a run have changed (update state, checkpoints, and shard  */
+/*  manifests).  */
+
+#define FNV_PRIME         1099511628211ULL
+
+
+
+/*  64 bit FNV-1a hash.  Start with FNV_OFFSET.  */
+
+uint64_t fnv (uint64_t hash, const void *data, size_t length)
+{
+  const uint8_t  *ptr = (const uint8_t *) data;
+  size_t         i;
+
+
+  for (i = 0 ; i < length ; i++)
+    {
+      hash ^= ptr[i];
+      hash *= FNV_PRIME;
+    }
+
+  return (hash);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        query_digest                                        *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Digest of everything other than the PFM bins that   *
+*                       the output of a query depends on (program version,  *
+*                       PFM or HOF list, area, time windows, and file       *
+*                       selection).  Shards leave the file selection out    *
+*                       since each one has its own.                         *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                       pfm_file       - PFM (or HOF list) file name        *
+*                       selection      - include the -F/-S file selection   *
+*                                                                           *
+*   Returns:            The digest                                          *
+*                                                                           *
+\***************************************************************************/
+
+uint64_t query_digest (QUERY *query, char *pfm_file, uint8_t selection)
+{
+  uint64_t       hash = FNV_OFFSET;
+
+
+  hash = fnv (hash, VERSION, strlen (VERSION));
+  hash = fnv (hash, pfm_file, strlen (pfm_file));
+  hash = fnv (hash, &options.use_index, sizeof (options.use_index));
+  hash = fnv (hash, query->area.x, query->area.count * sizeof (double));
+  hash = fnv (hash, query->area.y, query->area.count * sizeof (double));
+  hash = fnv (hash, query->area.ring_start, (query->area.ring_count + 1) * sizeof (int32_t));
+  if (query->window_count) hash = fnv (hash, query->windows, query->window_count * sizeof (TIME_WINDOW));
+  if (selection && options.file_mask != NULL) hash = fnv (hash, options.file_mask, options.file_count);
+
+  return (hash);
+}
@@ -0,0 +1,545 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+
+/*  Is this an input file that we want to extract from (a HOF file that belongs to this shard)?  */
+
+uint8_t want_file (int32_t file_number)
+{
+  if (file_number >= options.file_count || options.file_index[file_number].type != PFM_CHARTS_HOF_DATA) return (NVFalse);
+
+  if (options.file_mask != NULL && !options.file_mask[file_number]) return (NVFalse);
+
+  return (NVTrue);
+}
+
+
+
+/*  Extract the waveforms from one file and, if we're keeping track of them, record where this file's output went.  */
+
+static int32_t extract_file (QUERY *query, int32_t file_number, PING_RANGE *ranges, int32_t range_count)
+{
+  SEGMENT                *segment = NULL;
+  int32_t                count;
+
+
+  if (query->segments != NULL)
+    {
+      segment = &query->segments[query->segment_count];
+      segment->file_number = file_number;
+      segment->offset = ftello (query->txt_fp);
+    }
+
+  count = get_waveforms (file_number, ranges, range_count, query);
+
+  if (segment != NULL && count >= 0)
+    {
+      segment->length = ftello (query->txt_fp) - segment->offset;
+      segment->count = count;
+      query->segment_count++;
+    }
+
+  return (count);
+}
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        area_bins                                           *
+*                                                                           *
+*   Programmer(s):      Jan C. Depner                                       *
+*                                                                           *
+*   Date Written:       November 2010                                       *
+*                                                                           *
+*   Purpose:            Figure out the rectangle of PFM bins that covers    *
+*                       the query area.                                     *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                       x_start        - first bin column                   *
+*                       y_start        - first bin row                      *
+*                       width          - number of columns                  *
+*                       height         - number of rows                     *
+*                                                                           *
+*   Returns:            NVFalse if the area is outside of the PFM           *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t area_bins (QUERY *query, int32_t *x_start, int32_t *y_start, int32_t *width, int32_t *height)
+{
+  PFM_HEAD               *head;
+
+
+  head = &options.open_args.head;
+
+  if (query->area.mbr.min_y > head->mbr.max_y || query->area.mbr.max_y < head->mbr.min_y ||
+      query->area.mbr.min_x > head->mbr.max_x || query->area.mbr.max_x < head->mbr.min_x)
+    {
+      if (query->progress) fprintf (stderr, "\n\nSpecified area is completely outside of the PFM bounds!\n\n");
+      return (NVFalse);
+    }
+
+
+  /*  Match to nearest cell.  */
+
+  *x_start = NINT ((query->area.mbr.min_x - head->mbr.min_x) / head->x_bin_size_degrees);
+  *y_start = NINT ((query->area.mbr.min_y - head->mbr.min_y) / head->y_bin_size_degrees);
+  *width = NINT ((query->area.mbr.max_x - query->area.mbr.min_x) / head->x_bin_size_degrees);
+  *height = NINT ((query->area.mbr.max_y - query->area.mbr.min_y) / head->y_bin_size_degrees);
+
+
+  /*  Adjust to PFM bounds if necessary.  */
+
+  if (*x_start < 0) *x_start = 0;
+  if (*y_start < 0) *y_start = 0;
+  if (*x_start + *width > head->bin_width) *width = head->bin_width - *x_start;
+  if (*y_start + *height > head->bin_height) *height = head->bin_height - *y_start;
+
+  return (NVTrue);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        scan_area                                           *
+*                                                                           *
+*   Programmer(s):      Jan C. Depner                                       *
+*                                                                           *
+*   Date Written:       November 2010                                       *
+*                                                                           *
+*   Purpose:            Read the PFM bins that cover the query area and     *
+*                       build the list of input files and the min and max   *
+*                       record numbers that we need to look at in each.     *
+*                       If digest is set it gets a digest of the file,      *
+*                       record, and validity of every sounding in each bin  *
+*                       (row by row over the area_bins rectangle).          *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                       digest         - per bin digests or NULL            *
+*                                                                           *
+*   Returns:            Total number of records to be read, or -1 if the    *
+*                       area is outside of the PFM or the PFM is bad        *
+*                                                                           *
+\***************************************************************************/
+
+int32_t scan_area (QUERY *query, uint32_t *digest)
+{
+  int32_t                i, j, k, m, x_start, y_start, width, height, total, percent = 0, old_percent = -1, recnum, column;
+  NV_I32_COORD2          coord;
+  BIN_BUFFER             buffer;
+  DEPTH_RECORD           *depth;
+  uint64_t               hash;
+
+
+  if (!area_bins (query, &x_start, &y_start, &width, &height)) return (-1);
+
+
+  /*  Set all hits to false.  */
+
+  for (i = 0 ; i < MAX_PFM_FILES ; i++)
+    {
+      query->list[i].hit = NVFalse;
+      query->list[i].start = UINT32_MAX;
+      query->list[i].end = 0;
+    }
+
+
+  /*  Loop over the rows of the area reading all of the bin records in the row at once (or as many as fit in the  */
+  /*  memory budget) and then the soundings of the bins that have any.  The PFM library isn't thread safe so we lock  */
+  /*  it for each run of bins.  */
+
+  memset (&buffer, 0, sizeof (BIN_BUFFER));
+
+  for (i = y_start ; i < y_start + height ; i++)
+    {
+      coord.y = i;
+
+      for (column = x_start ; column < x_start + width ; column += buffer.width)
+        {
+          pthread_mutex_lock (&options.pfm_mutex);
+
+          if (read_bin_run (options.pfm_handle, i, column, x_start + width - column, &buffer) < 0)
+            {
+              pthread_mutex_unlock (&options.pfm_mutex);
+              fprintf (stderr, "\n\nError reading PFM row %d\n\n", i);
+              free_bin_buffer (&buffer);
+              return (-1);
+            }
+
+          for (j = 0 ; j < buffer.width ; j++)
+            {
+              coord.x = column + j;
+              hash = FNV_OFFSET;
+
+
+              /*  Get file numbers and min and max record numbers in file so we can figure out which waveforms to  */
+              /*  retrieve.  read_depth_array_index allocates the array on every call and there's no PFM call that  */
+              /*  reads a bin's soundings into a buffer of ours, so this can't use a pooled buffer.  */
+
+              depth = NULL;
+              recnum = 0;
+
+              if (buffer.bins[j].num_soundings && read_depth_array_index (options.pfm_handle, coord, &depth, &recnum))
+                {
+                  depth = NULL;
+                  recnum = 0;
+                }
+
+              for (k = 0 ; k < recnum ; k++)
+                {
+                  if (digest != NULL)
+                    {
+                      hash = fnv (hash, &depth[k].file_number, sizeof (depth[k].file_number));
+                      hash = fnv (hash, &depth[k].ping_number, sizeof (depth[k].ping_number));
+                      hash = fnv (hash, &depth[k].validity, sizeof (depth[k].validity));
+                    }
+
+                  if (!(depth[k].validity & PFM_DELETED))
+                    {
+                      m = depth[k].file_number;
+
+                      if (m < 0 || m >= MAX_PFM_FILES)
+                        {
+                          pthread_mutex_unlock (&options.pfm_mutex);
+                          fprintf (stderr, "\n\nFile number out of bounds - %d\n\n", m);
+                          free (depth);
+                          free_bin_buffer (&buffer);
+                          return (-1);
+                        }
+                      query->list[m].hit = NVTrue;
+                      if ((uint32_t) depth[k].ping_number < query->list[m].start) query->list[m].start = depth[k].ping_number;
+                      if ((uint32_t) depth[k].ping_number > query->list[m].end) query->list[m].end = depth[k].ping_number;
+                    }
+                }
+
+              free (depth);
+
+              if (digest != NULL) digest[(int64_t) (i - y_start) * width + coord.x - x_start] = (uint32_t) (hash ^ (hash >> 32));
+            }
+
+          pthread_mutex_unlock (&options.pfm_mutex);
+        }
+
+      if (query->progress)
+        {
+          percent = NINT (((float) (i - y_start) / (float) height) * 100.0);
+          if (percent != old_percent)
+            {
+              fprintf (stderr, "%03d%% read\r", percent);
+              fflush (stderr);
+              old_percent = percent;
+            }
+        }
+    }
+
+
+  free_bin_buffer (&buffer);
+
+
+  total = 0;
+  for (i = 0 ; i < MAX_PFM_FILES ; i++)
+    {
+      if (query->list[i].hit && !want_file (i)) query->list[i].hit = NVFalse;
+
+      if (query->list[i].hit) total += ((query->list[i].end - query->list[i].start) + 1);
+    }
+
+  return (total);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        extract_plan                                        *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Extract the waveforms for every file in the plan,   *
+*                       in order, with read-ahead running in front of us.   *
+*                       If the query has time windows the record ranges     *
+*                       are cut down to the windows first.  The plan's      *
+*                       ranges belong to the plan and are freed here.  In   *
+*                       grid mode the plan is handed to grid_plan.  If the  *
+*                       query has a checkpoint file (--resume) it is read   *
+*                       back first and updated as files are finished.       *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                       plan           - files and sorted record ranges     *
+*                       plan_count     - number of plan items               *
+*                                                                           *
+*   Returns:            Number of waveforms extracted or -1 on error        *
+*                                                                           *
+\***************************************************************************/
+
+int32_t extract_plan (QUERY *query, PREFETCH_ITEM *plan, int32_t plan_count)
+{
+  int32_t                i, j, count, icount = 0, kept, first;
+
+
+  query->count = 0;
+  query->old_percent = -1;
+  query->good_count = 0;
+  query->bad_count = 0;
+  query->segment_count = 0;
+  query->cache_pages = 0;
+  query->cache_resident = 0;
+
+  kept = 0;
+  query->total = 0;
+  for (i = 0 ; i < plan_count ; i++)
+    {
+      if (query->window_count && apply_time_windows (query, plan[i].file_number, &plan[i].ranges, &plan[i].range_count) < 0)
+        {
+          fprintf (stderr, "Unable to apply the time windows to %s\n", options.file_index[plan[i].file_number].path);
+          fflush (stderr);
+          plan[i].range_count = 0;
+        }
+
+      if (!plan[i].range_count)
+        {
+          free (plan[i].ranges);
+          continue;
+        }
+
+      for (j = 0 ; j < plan[i].range_count ; j++) query->total += plan[i].ranges[j].end - plan[i].ranges[j].start + 1;
+
+      plan[kept++] = plan[i];
+    }
+
+  plan_count = kept;
+
+
+  /*  Grid mode runs the files in parallel (and does without read-ahead).  */
+
+  if (query->grid != NULL)
+    {
+      icount = grid_plan (query, plan, plan_count);
+
+      for (i = 0 ; i < plan_count ; i++) free (plan[i].ranges);
+
+      return (icount);
+    }
+
+
+  /*  On --resume skip the files that were finished before the run was interrupted.  */
+
+  first = 0;
+  if (query->checkpoint_file != NULL && query->resume) first = resume_checkpoint (query, plan, plan_count, &icount);
+
+  if (first < 0)
+    {
+      for (i = 0 ; i < plan_count ; i++) free (plan[i].ranges);
+
+      return (-1);
+    }
+
+
+  start_prefetch (query, &plan[first], plan_count - first);
+
+  for (i = first ; i < plan_count ; i++)
+    {
+      prefetch_advance (query, &plan[first], i - first);
+
+      count = extract_file (query, plan[i].file_number, plan[i].ranges, plan[i].range_count);
+
+      prefetch_done (query, &plan[first], i - first, plan_count - first);
+
+      if (count < 0)
+        {
+          icount = -1;
+          break;
+        }
+
+      icount += count;
+
+      if (query->checkpoint_file != NULL && !write_checkpoint (query, plan, plan_count, i + 1, icount))
+        {
+          fprintf (stderr, "Unable to write checkpoint %s\n", query->checkpoint_file);
+          fflush (stderr);
+        }
+    }
+
+  stop_prefetch (query);
+
+  for (i = 0 ; i < plan_count ; i++) free (plan[i].ranges);
+
+  return (icount);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        extract_area                                        *
+*                                                                           *
+*   Programmer(s):      Jan C. Depner                                       *
+*                                                                           *
+*   Date Written:       November 2010                                       *
+*                                                                           *
+*   Purpose:            Scan the PFM for the query area and then extract    *
+*                       the waveforms from each HOF file that was hit.      *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                                                                           *
+*   Returns:            Number of waveforms extracted or -1 on error        *
+*                                                                           *
+\***************************************************************************/
+
+int32_t extract_area (QUERY *query)
+{
+  int32_t                i, plan_count, icount, count;
+  PREFETCH_ITEM          *plan;
+
+
+  if (options.use_index) return (extract_area_indexed (query));
+
+  if ((query->total = scan_area (query, NULL)) < 0) return (-1);
+
+
+  /*  scan_area has already dropped anything that isn't a HOF file (or isn't in this shard).  */
+
+  for (i = 0, count = 0 ; i < MAX_PFM_FILES ; i++) count += query->list[i].hit;
+
+  if (!reserve_memory ((int64_t) count * sizeof (PREFETCH_ITEM), NVFalse))
+    {
+      fprintf (stderr, "\n\nThe extraction plan doesn't fit in the memory budget\n\n");
+      return (-1);
+    }
+
+  if ((plan = (PREFETCH_ITEM *) malloc ((count ? count : 1) * sizeof (PREFETCH_ITEM))) == NULL)
+    {
+      release_memory ((int64_t) count * sizeof (PREFETCH_ITEM));
+      return (-1);
+    }
+
+  plan_count = 0;
+  for (i = 0 ; i < MAX_PFM_FILES ; i++)
+    {
+      if (query->list[i].hit)
+        {
+          if ((plan[plan_count].ranges = (PING_RANGE *) malloc (sizeof (PING_RANGE))) == NULL)
+            {
+              while (plan_count) free (plan[--plan_count].ranges);
+              free (plan);
+              release_memory ((int64_t) count * sizeof (PREFETCH_ITEM));
+              return (-1);
+            }
+
+          plan[plan_count].ranges[0].start = query->list[i].start;
+          plan[plan_count].ranges[0].end = query->list[i].end;
+          plan[plan_count].file_number = i;
+          plan[plan_count].range_count = 1;
+          plan_count++;
+        }
+    }
+
+  icount = extract_plan (query, plan, plan_count);
+
+  free (plan);
+  release_memory ((int64_t) count * sizeof (PREFETCH_ITEM));
+
+  return (icount);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        extract_area_indexed                                *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Same as extract_area but the candidate records      *
+*                       come from the HOF sidecar spatial indexes instead   *
+*                       of a scan of the PFM bins.  The shots go through    *
+*                       exactly the same filtering in get_waveforms.  If a  *
+*                       file's index can't be built or read (read only      *
+*                       survey directory, full disk) the whole file is      *
+*                       scanned instead.                                    *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                                                                           *
+*   Returns:            Number of waveforms extracted or -1 on error        *
+*                                                                           *
+\***************************************************************************/
+
+int32_t extract_area_indexed (QUERY *query)
+{
+  int32_t                i, icount, plan_count;
+  PREFETCH_ITEM          *plan;
+  struct stat            hof_stat;
+
+
+  if (!reserve_memory ((int64_t) options.file_count * sizeof (PREFETCH_ITEM), NVFalse))
+    {
+      fprintf (stderr, "\n\nThe extraction plan doesn't fit in the memory budget\n\n");
+      return (-1);
+    }
+
+  if ((plan = (PREFETCH_ITEM *) malloc (options.file_count * sizeof (PREFETCH_ITEM))) == NULL)
+    {
+      release_memory ((int64_t) options.file_count * sizeof (PREFETCH_ITEM));
+      return (-1);
+    }
+
+  plan_count = 0;
+  for (i = 0 ; i < options.file_count ; i++)
+    {
+      if (!want_file (i)) continue;
+
+      plan[plan_count].file_number = i;
+      plan[plan_count].range_count = hof_index_ranges (options.file_index[i].path, &query->area.mbr, &plan[plan_count].ranges);
+
+      if (plan[plan_count].range_count < 0)
+        {
+          fprintf (stderr, "Unable to read the sidecar index for %s, scanning the whole file\n", options.file_index[i].path);
+          fflush (stderr);
+
+          if (stat (options.file_index[i].path, &hof_stat) ||
+              (plan[plan_count].ranges = (PING_RANGE *) malloc (sizeof (PING_RANGE))) == NULL)
+            {
+              perror (options.file_index[i].path);
+              while (plan_count) free (plan[--plan_count].ranges);
+              free (plan);
+              release_memory ((int64_t) options.file_count * sizeof (PREFETCH_ITEM));
+              return (-1);
+            }
+
+          plan[plan_count].ranges[0].start = 1;
+          plan[plan_count].ranges[0].end = (int32_t) ((hof_stat.st_size - HOF_HEAD_SIZE) / sizeof (HYDRO_OUTPUT_T));
+          plan[plan_count].range_count = (plan[plan_count].ranges[0].end >= 1);
+        }
+
+      plan_count++;
+    }
+
+  icount = extract_plan (query, plan, plan_count);
+
+  free (plan);
+  release_memory ((int64_t) options.file_count * sizeof (PREFETCH_ITEM));
+
+  return (icount);
+}
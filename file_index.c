@@ -0,0 +1,159 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        load_file_index                                     *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Read the input file list from the open PFM once so  *
+*                       that we don't have to go back to the PFM library    *
+*                       (or the disk) for every file in every query.        *
+*                                                                           *
+\***************************************************************************/
+
+void load_file_index ()
+{
+  int16_t        i;
+
+
+  options.file_count = get_next_list_file_number (options.pfm_handle);
+  if (options.file_count > MAX_PFM_FILES) options.file_count = MAX_PFM_FILES;
+
+  options.file_index = (FILE_INDEX *) calloc (MAX_PFM_FILES, sizeof (FILE_INDEX));
+  if (options.file_index == NULL)
+    {
+      perror ("Allocating file index");
+      exit (-1);
+    }
+
+  for (i = 0 ; i < options.file_count ; i++)
+    {
+      read_list_file (options.pfm_handle, i, options.file_index[i].path, &options.file_index[i].type);
+      options.file_index[i].pos_state = 0;
+    }
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        find_pos_file                                       *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Return the name of the sbet (reprocessed) or pos    *
+*                       file for an input file.  The directory search is    *
+*                       only done the first time a file is asked for.       *
+*                                                                           *
+*   Arguments:          file_number    - PFM input file number              *
+*                       pos_file       - returned pos/sbet file name        *
+*                                                                           *
+*   Returns:            NVTrue if a pos/sbet file was found                 *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t find_pos_file (int32_t file_number, char *pos_file)
+{
+  FILE_INDEX     *entry;
+  uint8_t        found;
+
+
+  if (file_number < 0 || file_number >= options.file_count) return (NVFalse);
+
+  entry = &options.file_index[file_number];
+
+  pthread_mutex_lock (&options.pos_mutex);
+
+  if (!entry->pos_state) entry->pos_state = get_pos_file (entry->path, entry->pos_file) ? 1 : -1;
+
+  found = (entry->pos_state > 0);
+  if (found) strcpy (pos_file, entry->pos_file);
+
+  pthread_mutex_unlock (&options.pos_mutex);
+
+  return (found);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        load_file_list                                      *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Load the file index from a text file containing     *
+*                       one HOF file name per line instead of from a PFM.   *
+*                       Used when we already know which lines we want and   *
+*                       are getting the records from the sidecar indexes.   *
+*                                                                           *
+*   Arguments:          list_file      - text file of HOF file names        *
+*                                                                           *
+*   Returns:            Number of files or -1 on error                      *
+*                                                                           *
+\***************************************************************************/
+
+int32_t load_file_list (char *list_file)
+{
+  FILE           *fp;
+  char           string[512];
+  int32_t        len;
+
+
+  if ((fp = fopen (list_file, "r")) == NULL)
+    {
+      perror (list_file);
+      return (-1);
+    }
+
+  options.file_index = (FILE_INDEX *) calloc (MAX_PFM_FILES, sizeof (FILE_INDEX));
+  if (options.file_index == NULL)
+    {
+      perror ("Allocating file index");
+      exit (-1);
+    }
+
+  options.file_count = 0;
+
+  while (fgets (string, sizeof (string), fp) != NULL && options.file_count < MAX_PFM_FILES)
+    {
+      len = strlen (string);
+      while (len && (string[len - 1] == '\n' || string[len - 1] == '\r' || string[len - 1] == ' ')) string[--len] = 0;
+
+      if (len < 5 || string[0] == '#') continue;
+
+      strcpy (options.file_index[options.file_count].path, string);
+      options.file_index[options.file_count].type = PFM_CHARTS_HOF_DATA;
+      options.file_index[options.file_count].pos_state = 0;
+      options.file_count++;
+    }
+
+  fclose (fp);
+
+  return (options.file_count);
+}
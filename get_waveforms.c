@@ -0,0 +1,246 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+
+/*  Count a shot we couldn't find a position for and return the number so far.  The grid workers share one count  */
+/*  so the limit applies to the whole run.  */
+
+static int32_t count_bad_shot (QUERY *query)
+{
+  int32_t        bad_count;
+
+
+  if (query->shared_bad_count == NULL) return (++query->bad_count);
+
+  pthread_mutex_lock (query->shared_mutex);
+  bad_count = ++(*query->shared_bad_count);
+  pthread_mutex_unlock (query->shared_mutex);
+
+  return (bad_count);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        get_waveforms                                       *
+*                                                                           *
+*   Programmer(s):      Jan C. Depner                                       *
+*                                                                           *
+*   Date Written:       November 2010                                       *
+*                                                                           *
+*   Purpose:            Read the HOF records and waveforms for one or more  *
+*                       ranges of records in one input file and pass the    *
+*                       shots that are inside the query area to             *
+*                       process_waveforms.                                  *
+*                                                                           *
+*   Arguments:          file_number    - PFM input file number              *
+*                       ranges         - sorted HOF record ranges           *
+*                       range_count    - number of ranges                   *
+*                       query          - the area query                     *
+*                                                                           *
+*   Returns:            Number of good shots found                          *
+*                                                                           *
+\***************************************************************************/
+
+int32_t get_waveforms (int32_t file_number, PING_RANGE *ranges, int32_t range_count, QUERY *query)
+{
+  FILE                   *data_fp, *wave_fp, *pos_fp;
+  POS_OUTPUT_T           pos;
+  WAVE_HEADER_T          wave_header;
+  WAVE_DATA_T            wave_data;
+  WAVE_RESULT            result;
+  HYDRO_OUTPUT_T         hof;
+  HOF_READER             reader;
+  HOF_FIELDS             *fields;
+  int64_t                new_stamp, data_timestamp;
+  int32_t                i, r, percent, good_count = 0;
+  uint8_t                good_rec, pos_found;
+  char                   wave_file[512], pos_file[512], *path;
+
+
+  path = options.file_index[file_number].path;
+
+  strcpy (wave_file, path);
+  strcpy (&wave_file[strlen (wave_file) - 4], ".inh");
+
+  wave_fp = charts_open_wave (wave_file, &wave_header);
+
+  if (wave_fp == NULL) return (0);
+
+
+  if ((data_fp = charts_open_hof (path)) == NULL)
+    {
+      perror (path);
+      charts_close (wave_fp);
+      return (-1);
+    }
+
+  if (!open_hof_reader (&reader, data_fp))
+    {
+      perror ("Allocating HOF reader");
+      charts_close (data_fp);
+      charts_close (wave_fp);
+      return (-1);
+    }
+
+
+  /*  Find and open the sbet (reprocessed) or pos file.  This used to be done for every record but it's always the  */
+  /*  same file for a given HOF file.  */
+
+  pos_fp = NULL;
+  pos_found = find_pos_file (file_number, pos_file);
+  if (pos_found)
+    {
+      pthread_mutex_lock (&options.pos_mutex);
+      pos_fp = open_pos_file (pos_file);
+      pthread_mutex_unlock (&options.pos_mutex);
+    }
+
+
+  for (r = 0 ; r < range_count && good_count >= 0 ; r++)
+    {
+      for (i = ranges[r].start ; i <= ranges[r].end ; i++)
+        {
+          /*  Find the record based on the timestamp from the hof file.  */
+
+          fields = hof_read_fields (&reader, i, ranges[r].end);
+          data_timestamp = fields->timestamp;
+
+
+          if (fields->correct_depth != -998.0)
+            {
+              if (charts_read_wave (wave_fp, i, &wave_data))
+                {
+                  if (!pos_found)
+                    {
+                      fprintf (stderr, "Unable to find pos/sbet file for hof file %s\n", path);
+                      fflush (stderr);
+                    }
+                  else
+                    {
+                      if (pos_fp == NULL)
+                        {
+                          fprintf (stderr, "Unable to open pos/sbet file for hof file %s\n", path);
+                          fflush (stderr);
+                        }
+                      else
+                        {
+                          /*  Get the attitude data for this shot.  */
+
+                          pthread_mutex_lock (&options.pos_mutex);
+                          new_stamp = pos_find_record (pos_fp, &pos, data_timestamp);
+                          pthread_mutex_unlock (&options.pos_mutex);
+
+                          if (!new_stamp) 
+                            {
+                              fprintf (stderr, "\n\nUnable to get timestamp ");
+                              fprintf (stderr, "%"PRId64, data_timestamp);
+                              fprintf (stderr, " for pos/sbet file %s\n", pos_file);
+                              fprintf (stderr, "This usually indicates that the above pos/sbet file is FUBAR or the name is incorrect!\n");
+                              fprintf (stderr, "Make sure the file name conforms to the naming convention (_YYMMDD_NNNN.out or .pos) and\n");
+                              fprintf (stderr, "check the start and end times of this file (dump_pos) against the data in the HOF/TOF/IMG files.\n\n\n");
+
+                              if (count_bad_shot (query) > 100)
+                                {
+                                  good_count = -1;
+                                  break;
+                                }
+                            }
+                          else
+                            {
+                              good_rec = NVFalse;
+
+                              if (fields->abdc > 70 || (fields->correct_sec_depth != -998.0 && fields->sec_abdc > 70))
+                                {
+                                  /*  Assume GCS was right if it picked two returns.  */
+
+                                  if (fields->correct_depth == -998.0 || fields->correct_sec_depth == -998.0)
+                                    {
+                                      /*  Make sure we're inside the area we specified.  */
+
+                                      if (inside_area (&query->area, fields->longitude, fields->latitude))
+                                        {
+                                          good_rec = NVTrue;
+                                          good_count++;
+                                          query->good_count++;
+                                        }
+                                    }
+                                }
+
+                              /*  Only now do we need the whole record.  */
+
+                              if (good_rec) hof_read_full (&reader, i, &hof);
+
+                              if (good_rec && process_waveforms (&hof, &wave_header, &wave_data, &result))
+                                {
+                                  if (query->grid != NULL)
+                                    {
+                                      add_grid_result (query->grid, &hof, &result);
+                                    }
+                                  else
+                                    {
+                                      write_waveform_result (query->txt_fp, &hof, file_number, i, &result);
+                                    }
+                                }
+                              else if (good_rec && query->max_missed && !add_missed_shot (query, file_number, i))
+                                {
+                                  good_count = -1;
+                                  break;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+          query->count++;
+          if (query->progress)
+            {
+              percent = ((float) query->count / (float) query->total) * 100.0;
+              if (percent != query->old_percent)
+                {
+                  query->old_percent = percent;
+                  fprintf (stderr, "%03d%% processed            \r", percent);
+                  fflush (stderr);
+                }
+            }
+        }
+    }
+
+
+  if (pos_fp != NULL)
+    {
+      pthread_mutex_lock (&options.pos_mutex);
+      fclose (pos_fp);
+      pthread_mutex_unlock (&options.pos_mutex);
+    }
+
+  close_hof_reader (&reader);
+  charts_close (wave_fp);
+  charts_close (data_fp);
+
+  return (good_count);
+}
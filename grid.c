@@ -0,0 +1,470 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+
+/*  Grid mode (-g) reduces the waveform results straight onto the PFM bins that cover the area instead of writing a  */
+/*  line for every shot.  The files in the extraction plan are handed out to grid_threads worker threads.  Each worker  */
+/*  accumulates into its own grid (the first one uses the final grid) and the grids are added together at the end.  */
+/*  The HOF and INH reads go through charts_io.c one at a time, so the workers overlap the waveform processing and  */
+/*  the raw HOF block reads but not the calls into the CHARTS library.  */
+/*  All of the sums are 64 bit integers so the result doesn't depend on the number of threads or the order of the  */
+/*  files, and a bin can't overflow however many shots land in it.  */
+/*  The output is a GRID_FILE_HEADER followed by width * height GRID_FILE_CELL records, row by row from the south,  */
+/*  in native byte order.  */
+
+#define GRID_MAGIC    "PWGRID02"
+
+
+typedef struct
+{
+  char          magic[8];
+  int32_t       width;
+  int32_t       height;
+  int32_t       x_start;                  /*  PFM bin column and row of the first cell  */
+  int32_t       y_start;
+  NV_F64_XYMBR  mbr;                      /*  Bounds of the grid  */
+  double        x_bin_size_degrees;
+  double        y_bin_size_degrees;
+} GRID_FILE_HEADER;
+
+
+typedef struct
+{
+  uint64_t      shots;                    /*  Shots with a waveform result in the bin  */
+  uint64_t      runs[2];                  /*  PMT and APD qualifying runs  */
+  float         mean_rise[2];             /*  Mean rise of the runs  */
+  float         mean_run[2];              /*  Mean length of the runs  */
+  float         second_rate[2];           /*  Fraction of the shots with a second run  */
+} GRID_FILE_CELL;
+
+
+typedef struct
+{
+  QUERY           *query;
+  PREFETCH_ITEM   *plan;
+  int32_t         plan_count;
+  int32_t         next;
+  int32_t         done;
+  int32_t         icount;
+  uint8_t         failed;
+  pthread_mutex_t mutex;
+} GRID_WORK;
+
+
+typedef struct
+{
+  GRID_WORK     *work;
+  GRID          grid;
+  pthread_t     thread;
+} GRID_WORKER;
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        init_grid                                           *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Set up an empty grid over the PFM bins that cover   *
+*                       the query area.                                     *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                       grid           - the grid                           *
+*                                                                           *
+*   Returns:            NVFalse if the area is outside of the PFM or we're  *
+*                       out of memory                                       *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t init_grid (QUERY *query, GRID *grid)
+{
+  PFM_HEAD       *head;
+  int32_t        x_end, y_end;
+
+
+  head = &options.open_args.head;
+
+  memset (grid, 0, sizeof (GRID));
+
+
+  /*  Unlike the bin scan we want every bin that any part of the area touches.  */
+
+  grid->x_start = (int32_t) floor ((query->area.mbr.min_x - head->mbr.min_x) / head->x_bin_size_degrees);
+  grid->y_start = (int32_t) floor ((query->area.mbr.min_y - head->mbr.min_y) / head->y_bin_size_degrees);
+  x_end = (int32_t) floor ((query->area.mbr.max_x - head->mbr.min_x) / head->x_bin_size_degrees);
+  y_end = (int32_t) floor ((query->area.mbr.max_y - head->mbr.min_y) / head->y_bin_size_degrees);
+
+  if (grid->x_start < 0) grid->x_start = 0;
+  if (grid->y_start < 0) grid->y_start = 0;
+  if (x_end >= head->bin_width) x_end = head->bin_width - 1;
+  if (y_end >= head->bin_height) y_end = head->bin_height - 1;
+
+  grid->width = x_end - grid->x_start + 1;
+  grid->height = y_end - grid->y_start + 1;
+
+  if (grid->width < 1 || grid->height < 1)
+    {
+      fprintf (stderr, "\n\nSpecified area is completely outside of the PFM bounds!\n\n");
+      return (NVFalse);
+    }
+
+  /*  The output grid is the one thing grid mode can't do without so if it doesn't fit in the memory budget we stop  */
+  /*  here.  Extra worker grids are only added if they fit (see grid_plan).  */
+
+  if (!reserve_memory ((int64_t) grid->width * grid->height * sizeof (GRID_CELL), NVFalse))
+    {
+      fprintf (stderr, "\n\nThe %d by %d grid (%.1f MB) doesn't fit in the memory budget\n\n", grid->width, grid->height,
+               (double) grid->width * grid->height * sizeof (GRID_CELL) / 1048576.0);
+      return (NVFalse);
+    }
+
+  if ((grid->cell = (GRID_CELL *) calloc ((int64_t) grid->width * grid->height, sizeof (GRID_CELL))) == NULL)
+    {
+      perror ("Allocating grid");
+      release_memory ((int64_t) grid->width * grid->height * sizeof (GRID_CELL));
+      return (NVFalse);
+    }
+
+  return (NVTrue);
+}
+
+
+
+void free_grid (GRID *grid)
+{
+  if (grid->cell != NULL) release_memory ((int64_t) grid->width * grid->height * sizeof (GRID_CELL));
+
+  free (grid->cell);
+  grid->cell = NULL;
+}
+
+
+
+/*  Add the PMT and APD results for one shot to the grid.  */
+
+void add_grid_result (GRID *grid, HYDRO_OUTPUT_T *hof, WAVE_RESULT *result)
+{
+  PFM_HEAD       *head;
+  GRID_CELL      *cell;
+  WAVE_RUNS      *runs;
+  int32_t        col, row, c, j;
+
+
+  head = &options.open_args.head;
+
+  col = (int32_t) floor ((hof->longitude - head->mbr.min_x) / head->x_bin_size_degrees) - grid->x_start;
+  row = (int32_t) floor ((hof->latitude - head->mbr.min_y) / head->y_bin_size_degrees) - grid->y_start;
+
+  if (col < 0 || col >= grid->width || row < 0 || row >= grid->height) return;
+
+  cell = &grid->cell[(int64_t) row * grid->width + col];
+
+  cell->shots++;
+
+  for (c = 0 ; c < 2 ; c++)
+    {
+      runs = &result->channel[c];
+
+      cell->runs[c] += runs->count;
+      if (runs->count == 2) cell->second[c]++;
+
+      for (j = 0 ; j < runs->count ; j++)
+        {
+          cell->rise[c] += runs->rise[j];
+          cell->run[c] += runs->run[j];
+        }
+    }
+}
+
+
+
+static void *grid_worker (void *arg)
+{
+  GRID_WORKER    *worker = (GRID_WORKER *) arg;
+  GRID_WORK      *work = worker->work;
+  QUERY          query;
+  int32_t        i, count, records, good_count;
+
+
+  /*  Each worker gets its own copy of the query so that the grid is its own.  The bad shots are counted in the  */
+  /*  original query as they happen so the limit in get_waveforms applies to the run, and the record and good shot  */
+  /*  counts are added to it after each file.  */
+
+  query = *work->query;
+  query.grid = &worker->grid;
+  query.txt_fp = NULL;
+  query.progress = NVFalse;
+  query.segments = NULL;
+  query.prefetch = NULL;
+  query.shared_bad_count = &work->query->bad_count;
+  query.shared_mutex = &work->mutex;
+
+  while (NVTrue)
+    {
+      pthread_mutex_lock (&work->mutex);
+      i = work->failed ? work->plan_count : work->next++;
+      pthread_mutex_unlock (&work->mutex);
+
+      if (i >= work->plan_count) break;
+
+      records = query.count;
+      good_count = query.good_count;
+
+      count = get_waveforms (work->plan[i].file_number, work->plan[i].ranges, work->plan[i].range_count, &query);
+
+      pthread_mutex_lock (&work->mutex);
+
+      work->query->count += query.count - records;
+      work->query->good_count += query.good_count - good_count;
+
+      if (count < 0)
+        {
+          work->failed = NVTrue;
+        }
+      else
+        {
+          work->icount += count;
+          work->done++;
+
+          if (work->query->progress)
+            {
+              fprintf (stderr, "%d of %d files gridded\r", work->done, work->plan_count);
+              fflush (stderr);
+            }
+        }
+
+      pthread_mutex_unlock (&work->mutex);
+    }
+
+  return (NULL);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        grid_plan                                           *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Extract the waveforms for every file in the plan    *
+*                       into query->grid using up to grid_threads worker    *
+*                       threads (fewer if their grids don't fit in the      *
+*                       memory budget).                                     *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                       plan           - files and sorted record ranges     *
+*                       plan_count     - number of plan items               *
+*                                                                           *
+*   Returns:            Number of waveforms added to the grid or -1 on      *
+*                       error                                               *
+*                                                                           *
+\***************************************************************************/
+
+int32_t grid_plan (QUERY *query, PREFETCH_ITEM *plan, int32_t plan_count)
+{
+  GRID_WORK      work;
+  GRID_WORKER    *worker;
+  int32_t        i, threads, started;
+  int64_t        j, cells, grid_size;
+
+
+  threads = options.grid_threads;
+  if (threads > plan_count) threads = plan_count;
+  if (threads < 1) threads = 1;
+
+  if ((worker = (GRID_WORKER *) calloc (threads, sizeof (GRID_WORKER))) == NULL)
+    {
+      perror ("Allocating grid workers");
+      return (-1);
+    }
+
+  memset (&work, 0, sizeof (GRID_WORK));
+  work.query = query;
+  work.plan = plan;
+  work.plan_count = plan_count;
+  pthread_mutex_init (&work.mutex, NULL);
+
+  cells = (int64_t) query->grid->width * query->grid->height;
+  grid_size = cells * sizeof (GRID_CELL);
+
+
+  /*  The first worker uses the final grid, the others get their own if they fit.  */
+
+  worker[0].work = &work;
+  worker[0].grid = *query->grid;
+
+  for (i = 1 ; i < threads ; i++)
+    {
+      if (!reserve_memory (grid_size, NVFalse)) break;
+
+      worker[i].work = &work;
+      worker[i].grid = *query->grid;
+
+      if ((worker[i].grid.cell = (GRID_CELL *) calloc (cells, sizeof (GRID_CELL))) == NULL)
+        {
+          release_memory (grid_size);
+          break;
+        }
+    }
+
+  threads = i;
+
+
+  for (started = 0 ; started < threads ; started++)
+    {
+      if (pthread_create (&worker[started].thread, NULL, grid_worker, &worker[started])) break;
+    }
+
+  if (!started) grid_worker (&worker[0]);
+
+  for (i = 0 ; i < started ; i++) pthread_join (worker[i].thread, NULL);
+
+
+  /*  Add the other workers' grids into the final grid.  */
+
+  for (i = 1 ; i < threads ; i++)
+    {
+      for (j = 0 ; j < cells ; j++)
+        {
+          query->grid->cell[j].shots += worker[i].grid.cell[j].shots;
+          query->grid->cell[j].runs[0] += worker[i].grid.cell[j].runs[0];
+          query->grid->cell[j].runs[1] += worker[i].grid.cell[j].runs[1];
+          query->grid->cell[j].second[0] += worker[i].grid.cell[j].second[0];
+          query->grid->cell[j].second[1] += worker[i].grid.cell[j].second[1];
+          query->grid->cell[j].rise[0] += worker[i].grid.cell[j].rise[0];
+          query->grid->cell[j].rise[1] += worker[i].grid.cell[j].rise[1];
+          query->grid->cell[j].run[0] += worker[i].grid.cell[j].run[0];
+          query->grid->cell[j].run[1] += worker[i].grid.cell[j].run[1];
+        }
+
+      free (worker[i].grid.cell);
+      release_memory (grid_size);
+    }
+
+  pthread_mutex_destroy (&work.mutex);
+  free (worker);
+
+  if (query->progress) fprintf (stderr, "\n");
+
+  return (work.failed ? -1 : work.icount);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        write_grid                                          *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Write the grid statistics file.                     *
+*                                                                           *
+*   Arguments:          grid_file      - output file name                   *
+*                       grid           - the grid                           *
+*                                                                           *
+*   Returns:            NVFalse on error                                    *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t write_grid (char *grid_file, GRID *grid)
+{
+  FILE              *fp;
+  PFM_HEAD          *head;
+  GRID_FILE_HEADER  file_head;
+  GRID_FILE_CELL    *out;
+  GRID_CELL         *cell;
+  int32_t           row, col, c;
+
+
+  head = &options.open_args.head;
+
+  memset (&file_head, 0, sizeof (GRID_FILE_HEADER));
+  memcpy (file_head.magic, GRID_MAGIC, 8);
+  file_head.width = grid->width;
+  file_head.height = grid->height;
+  file_head.x_start = grid->x_start;
+  file_head.y_start = grid->y_start;
+  file_head.x_bin_size_degrees = head->x_bin_size_degrees;
+  file_head.y_bin_size_degrees = head->y_bin_size_degrees;
+  file_head.mbr.min_x = head->mbr.min_x + grid->x_start * head->x_bin_size_degrees;
+  file_head.mbr.min_y = head->mbr.min_y + grid->y_start * head->y_bin_size_degrees;
+  file_head.mbr.max_x = file_head.mbr.min_x + grid->width * head->x_bin_size_degrees;
+  file_head.mbr.max_y = file_head.mbr.min_y + grid->height * head->y_bin_size_degrees;
+
+  if ((out = (GRID_FILE_CELL *) calloc (grid->width, sizeof (GRID_FILE_CELL))) == NULL)
+    {
+      perror ("Allocating grid row");
+      return (NVFalse);
+    }
+
+  if ((fp = fopen (grid_file, "wb")) == NULL)
+    {
+      perror (grid_file);
+      free (out);
+      return (NVFalse);
+    }
+
+  if (fwrite (&file_head, sizeof (GRID_FILE_HEADER), 1, fp) != 1) goto FAILED;
+
+  for (row = 0 ; row < grid->height ; row++)
+    {
+      for (col = 0 ; col < grid->width ; col++)
+        {
+          cell = &grid->cell[(int64_t) row * grid->width + col];
+
+          out[col].shots = cell->shots;
+
+          for (c = 0 ; c < 2 ; c++)
+            {
+              out[col].runs[c] = cell->runs[c];
+              out[col].mean_rise[c] = cell->runs[c] ? (float) cell->rise[c] / (float) cell->runs[c] : 0.0;
+              out[col].mean_run[c] = cell->runs[c] ? (float) cell->run[c] / (float) cell->runs[c] : 0.0;
+              out[col].second_rate[c] = cell->shots ? (float) cell->second[c] / (float) cell->shots : 0.0;
+            }
+        }
+
+      if (fwrite (out, sizeof (GRID_FILE_CELL), grid->width, fp) != (size_t) grid->width) goto FAILED;
+    }
+
+  free (out);
+
+  if (fclose (fp))
+    {
+      perror (grid_file);
+      return (NVFalse);
+    }
+
+  return (NVTrue);
+
+
+ FAILED:
+
+  perror (grid_file);
+  free (out);
+  fclose (fp);
+  return (NVFalse);
+}
@@ -0,0 +1,569 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+#include <unistd.h>
+
+
+/*  The sidecar index for a HOF file is a simple lat/lon grid laid over the MBR of the shots in the file.  Each grid  */
+/*  cell has a list of the ranges of consecutive HOF records that fall in the cell.  The file is written in native  */
+/*  byte order (it's a cache, not an exchange format) and is rebuilt whenever the size or modification time of the  */
+/*  HOF file doesn't match what was recorded in the index header.  Shots that get_waveforms would never use (no depth  */
+/*  or no usable position) aren't indexed so that one bad fix can't stretch the grid over half the globe.  */
+
+#define HOF_INDEX_MAGIC       "HOFIDX02"
+#define HOF_INDEX_MAX_GRID    512
+
+
+typedef struct
+{
+  char          magic[8];
+  int64_t       hof_size;
+  int64_t       hof_mtime;
+  int32_t       records;
+  int32_t       grid_width;
+  int32_t       grid_height;
+  int32_t       range_count;
+  NV_F64_XYMBR  mbr;
+  double        cell_x;
+  double        cell_y;
+} HOF_INDEX_HEADER;
+
+
+static pthread_mutex_t index_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/*  Sidecar index file name for a HOF file.  */
+
+static void hof_index_name (char *path, char *index_file)
+{
+  strcpy (index_file, path);
+  strcpy (&index_file[strlen (index_file) - 4], ".hix");
+}
+
+
+
+/*  Check an index header against the size of the index file so that a truncated or corrupt index is never trusted.  */
+
+static uint8_t valid_index_header (HOF_INDEX_HEADER *head, FILE *idx_fp)
+{
+  struct stat    idx_stat;
+  int64_t        cells;
+
+
+  if (memcmp (head->magic, HOF_INDEX_MAGIC, 8) || head->records < 1 || head->range_count < 0 || head->grid_width < 1 ||
+      head->grid_width > HOF_INDEX_MAX_GRID || head->grid_height < 1 || head->grid_height > HOF_INDEX_MAX_GRID ||
+      !(head->cell_x > 0.0) || !(head->cell_y > 0.0) || fstat (fileno (idx_fp), &idx_stat)) return (NVFalse);
+
+  cells = (int64_t) head->grid_width * head->grid_height;
+
+  return ((int64_t) idx_stat.st_size == (int64_t) sizeof (HOF_INDEX_HEADER) + (cells + 1) * (int64_t) sizeof (int32_t) +
+          (int64_t) head->range_count * (int64_t) sizeof (PING_RANGE));
+}
+
+
+
+static int32_t hof_index_cell (HOF_INDEX_HEADER *head, double lon, double lat)
+{
+  int32_t        col, row;
+
+
+  col = (int32_t) ((lon - head->mbr.min_x) / head->cell_x);
+  row = (int32_t) ((lat - head->mbr.min_y) / head->cell_y);
+
+  if (col < 0) col = 0;
+  if (col >= head->grid_width) col = head->grid_width - 1;
+  if (row < 0) row = 0;
+  if (row >= head->grid_height) row = head->grid_height - 1;
+
+  return (row * head->grid_width + col);
+}
+
+
+
+/*  NVFalse for shots that get_waveforms is going to throw away no matter what the area is.  */
+
+static uint8_t usable_shot (HYDRO_OUTPUT_T *hof)
+{
+  if (hof->correct_depth == -998.0) return (NVFalse);
+
+  if (!(hof->latitude >= -90.0 && hof->latitude <= 90.0 && hof->longitude >= -180.0 && hof->longitude <= 180.0))
+    return (NVFalse);
+
+  if (hof->latitude == 0.0 && hof->longitude == 0.0) return (NVFalse);
+
+  return (NVTrue);
+}
+
+
+
+/*  Position of record i (0 based).  If the positions didn't fit in the memory budget they're read from the file each  */
+/*  time.  Returns NVFalse if the shot isn't indexed (these are flagged with a latitude of 999 in memory).  */
+
+static uint8_t record_position (FILE *hof_fp, double *lat, double *lon, int32_t i, double *y, double *x)
+{
+  HYDRO_OUTPUT_T hof;
+
+
+  if (lat != NULL)
+    {
+      *y = lat[i];
+      *x = lon[i];
+      return (*y != 999.0);
+    }
+
+  charts_read_hof (hof_fp, i + 1, &hof);
+  *y = hof.latitude;
+  *x = hof.longitude;
+
+  return (usable_shot (&hof));
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        build_hof_index                                     *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Build the sidecar spatial index (.hix) for a HOF    *
+*                       file if it doesn't exist or is out of date.         *
+*                                                                           *
+*   Arguments:          path           - HOF file name                      *
+*                       force          - rebuild even if it's up to date    *
+*                                                                           *
+*   Returns:            NVTrue on success                                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t build_hof_index (char *path, uint8_t force)
+{
+  FILE                   *hof_fp, *idx_fp;
+  HYDRO_OUTPUT_T         hof;
+  HOF_INDEX_HEADER       head, old_head;
+  struct stat            hof_stat;
+  char                   index_file[512], tmp_file[528];
+  double                 *lat = NULL, *lon = NULL, x, y;
+  int64_t                reserved = 0;
+  int32_t                i, cell, cells, *offset = NULL, *fill = NULL, *last = NULL, *range = NULL, side, prev, used;
+  uint8_t                status = NVFalse;
+
+
+  if (stat (path, &hof_stat))
+    {
+      perror (path);
+      return (NVFalse);
+    }
+
+  hof_index_name (path, index_file);
+
+  pthread_mutex_lock (&index_mutex);
+
+
+  /*  Check for an up to date index.  */
+
+  if (!force && (idx_fp = fopen (index_file, "rb")) != NULL)
+    {
+      if (fread (&old_head, sizeof (HOF_INDEX_HEADER), 1, idx_fp) == 1 && valid_index_header (&old_head, idx_fp) &&
+          old_head.hof_size == (int64_t) hof_stat.st_size && old_head.hof_mtime == (int64_t) hof_stat.st_mtime)
+        {
+          fclose (idx_fp);
+          pthread_mutex_unlock (&index_mutex);
+          return (NVTrue);
+        }
+
+      fclose (idx_fp);
+    }
+
+
+  if ((hof_fp = charts_open_hof (path)) == NULL)
+    {
+      perror (path);
+      pthread_mutex_unlock (&index_mutex);
+      return (NVFalse);
+    }
+
+  memset (&head, 0, sizeof (HOF_INDEX_HEADER));
+  memcpy (head.magic, HOF_INDEX_MAGIC, 8);
+  head.hof_size = hof_stat.st_size;
+  head.hof_mtime = hof_stat.st_mtime;
+  head.records = (int32_t) ((hof_stat.st_size - HOF_HEAD_SIZE) / sizeof (HYDRO_OUTPUT_T));
+
+  if (head.records < 1)
+    {
+      charts_close (hof_fp);
+      pthread_mutex_unlock (&index_mutex);
+      return (NVFalse);
+    }
+
+
+  /*  Read the positions of all of the shots.  HOF records are numbered from 1.  If they don't fit in the memory  */
+  /*  budget we'll read them again on each pass instead.  */
+
+  if (reserve_memory ((int64_t) head.records * 2 * sizeof (double), NVFalse))
+    {
+      reserved = (int64_t) head.records * 2 * sizeof (double);
+
+      lat = (double *) malloc (head.records * sizeof (double));
+      lon = (double *) malloc (head.records * sizeof (double));
+
+      if (lat == NULL || lon == NULL)
+        {
+          perror ("Allocating HOF index positions");
+          goto CLEANUP;
+        }
+    }
+
+  head.mbr.min_x = head.mbr.min_y = 999.0;
+  head.mbr.max_x = head.mbr.max_y = -999.0;
+
+  used = 0;
+  for (i = 0 ; i < head.records ; i++)
+    {
+      charts_read_hof (hof_fp, i + 1, &hof);
+
+      if (!usable_shot (&hof))
+        {
+          if (lat != NULL) lat[i] = 999.0;
+          continue;
+        }
+
+      if (lat != NULL)
+        {
+          lat[i] = hof.latitude;
+          lon[i] = hof.longitude;
+        }
+
+      used++;
+
+      if (hof.longitude < head.mbr.min_x) head.mbr.min_x = hof.longitude;
+      if (hof.longitude > head.mbr.max_x) head.mbr.max_x = hof.longitude;
+      if (hof.latitude < head.mbr.min_y) head.mbr.min_y = hof.latitude;
+      if (hof.latitude > head.mbr.max_y) head.mbr.max_y = hof.latitude;
+    }
+
+
+  /*  Aim for roughly 64 shots per cell with a limit on the grid size.  */
+
+  side = (int32_t) sqrt ((double) used / 64.0) + 1;
+  if (side > HOF_INDEX_MAX_GRID) side = HOF_INDEX_MAX_GRID;
+
+  head.grid_width = head.grid_height = side;
+  head.cell_x = (head.mbr.max_x - head.mbr.min_x) / (double) side;
+  head.cell_y = (head.mbr.max_y - head.mbr.min_y) / (double) side;
+  if (head.cell_x <= 0.0) head.cell_x = 1.0;
+  if (head.cell_y <= 0.0) head.cell_y = 1.0;
+
+  cells = side * side;
+
+  offset = (int32_t *) calloc (cells + 1, sizeof (int32_t));
+  fill = (int32_t *) calloc (cells, sizeof (int32_t));
+  last = (int32_t *) malloc (cells * sizeof (int32_t));
+
+  if (offset == NULL || fill == NULL || last == NULL)
+    {
+      perror ("Allocating HOF index grid");
+      goto CLEANUP;
+    }
+
+
+  /*  First pass - count the record ranges in each cell.  A new range starts whenever the previous indexed record in  */
+  /*  the cell wasn't the last indexed record.  Shots that weren't indexed in between are left in the range since  */
+  /*  get_waveforms will drop them anyway.  */
+
+  for (i = 0 ; i < cells ; i++) last[i] = -2;
+
+  prev = -2;
+  for (i = 0 ; i < head.records ; i++)
+    {
+      if (!record_position (hof_fp, lat, lon, i, &y, &x)) continue;
+
+      cell = hof_index_cell (&head, x, y);
+      if (last[cell] != prev) offset[cell + 1]++;
+      last[cell] = prev = i;
+    }
+
+  for (i = 0 ; i < cells ; i++) offset[i + 1] += offset[i];
+
+  head.range_count = offset[cells];
+
+
+  /*  The ranges are the index itself so if they don't fit in the memory budget we can't build it (extraction will  */
+  /*  scan the whole file instead).  */
+
+  if (!reserve_memory ((int64_t) head.range_count * 2 * sizeof (int32_t), NVFalse))
+    {
+      fprintf (stderr, "The %d record ranges for %s don't fit in the memory budget\n", head.range_count, index_file);
+      goto CLEANUP;
+    }
+  reserved += (int64_t) head.range_count * 2 * sizeof (int32_t);
+
+  if ((range = (int32_t *) malloc (head.range_count * 2 * sizeof (int32_t))) == NULL)
+    {
+      perror ("Allocating HOF index ranges");
+      goto CLEANUP;
+    }
+
+
+  /*  Second pass - fill in the ranges (as 1 based record numbers).  */
+
+  for (i = 0 ; i < cells ; i++) last[i] = -2;
+
+  prev = -2;
+  for (i = 0 ; i < head.records ; i++)
+    {
+      if (!record_position (hof_fp, lat, lon, i, &y, &x)) continue;
+
+      cell = hof_index_cell (&head, x, y);
+
+      if (last[cell] != prev)
+        {
+          range[(offset[cell] + fill[cell]) * 2] = i + 1;
+          fill[cell]++;
+        }
+
+      range[(offset[cell] + fill[cell] - 1) * 2 + 1] = i + 1;
+      last[cell] = prev = i;
+    }
+
+
+  /*  Write to a temporary file and rename it so that nobody ever sees a partial index.  */
+
+  sprintf (tmp_file, "%s.%d", index_file, (int32_t) getpid ());
+
+  if ((idx_fp = fopen (tmp_file, "wb")) == NULL)
+    {
+      perror (tmp_file);
+      goto CLEANUP;
+    }
+
+  if (fwrite (&head, sizeof (HOF_INDEX_HEADER), 1, idx_fp) != 1 ||
+      fwrite (offset, sizeof (int32_t), cells + 1, idx_fp) != (size_t) (cells + 1) ||
+      fwrite (range, 2 * sizeof (int32_t), head.range_count, idx_fp) != (size_t) head.range_count)
+    {
+      perror (tmp_file);
+      fclose (idx_fp);
+      remove (tmp_file);
+      goto CLEANUP;
+    }
+
+  fclose (idx_fp);
+
+  if (rename (tmp_file, index_file))
+    {
+      perror (index_file);
+      remove (tmp_file);
+      goto CLEANUP;
+    }
+
+  status = NVTrue;
+
+
+ CLEANUP:
+
+  free (lat);
+  free (lon);
+  free (offset);
+  free (fill);
+  free (last);
+  free (range);
+  release_memory (reserved);
+
+  charts_close (hof_fp);
+
+  pthread_mutex_unlock (&index_mutex);
+
+  return (status);
+}
+
+
+
+static int32_t compare_ranges (const void *a, const void *b)
+{
+  const PING_RANGE *ra = (const PING_RANGE *) a, *rb = (const PING_RANGE *) b;
+
+  if (ra->start < rb->start) return (-1);
+  if (ra->start > rb->start) return (1);
+  return (0);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        hof_index_ranges                                    *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Get the sorted, merged list of HOF record ranges    *
+*                       in the index cells that overlap an MBR.  These are  *
+*                       candidates only, the shots still have to be tested  *
+*                       against the polygon.                                *
+*                                                                           *
+*   Arguments:          path           - HOF file name                      *
+*                       mbr            - area MBR                           *
+*                       ranges         - returned, allocated array of       *
+*                                        ranges (caller frees)              *
+*                                                                           *
+*   Returns:            Number of ranges, or -1 on error (including a       *
+*                       truncated or corrupt index)                         *
+*                                                                           *
+\***************************************************************************/
+
+int32_t hof_index_ranges (char *path, NV_F64_XYMBR *mbr, PING_RANGE **ranges)
+{
+  FILE                   *idx_fp;
+  HOF_INDEX_HEADER       head;
+  char                   index_file[512];
+  int32_t                i, j, row, start_col, end_col, start_row, end_row, cells, count, merged, *offset;
+  PING_RANGE             *list;
+
+
+  *ranges = NULL;
+
+  if (!build_hof_index (path, NVFalse)) return (-1);
+
+  hof_index_name (path, index_file);
+
+  if ((idx_fp = fopen (index_file, "rb")) == NULL)
+    {
+      perror (index_file);
+      return (-1);
+    }
+
+  if (fread (&head, sizeof (HOF_INDEX_HEADER), 1, idx_fp) != 1 || !valid_index_header (&head, idx_fp))
+    {
+      fclose (idx_fp);
+      return (-1);
+    }
+
+
+  /*  Nothing to do if the area doesn't overlap this file.  */
+
+  if (mbr->min_x > head.mbr.max_x || mbr->max_x < head.mbr.min_x || mbr->min_y > head.mbr.max_y || mbr->max_y < head.mbr.min_y)
+    {
+      fclose (idx_fp);
+      return (0);
+    }
+
+  cells = head.grid_width * head.grid_height;
+
+  if ((offset = (int32_t *) malloc ((cells + 1) * sizeof (int32_t))) == NULL ||
+      fread (offset, sizeof (int32_t), cells + 1, idx_fp) != (size_t) (cells + 1))
+    {
+      free (offset);
+      fclose (idx_fp);
+      return (-1);
+    }
+
+
+  /*  The offsets have to run from 0 to range_count without going backwards.  */
+
+  for (i = 0 ; i < cells ; i++)
+    {
+      if (offset[i] < 0 || offset[i] > offset[i + 1]) break;
+    }
+
+  if (i < cells || offset[0] || offset[cells] != head.range_count)
+    {
+      free (offset);
+      fclose (idx_fp);
+      return (-1);
+    }
+
+  start_col = hof_index_cell (&head, mbr->min_x, head.mbr.min_y);
+  end_col = hof_index_cell (&head, mbr->max_x, head.mbr.min_y);
+  start_row = hof_index_cell (&head, head.mbr.min_x, mbr->min_y) / head.grid_width;
+  end_row = hof_index_cell (&head, head.mbr.min_x, mbr->max_y) / head.grid_width;
+
+
+  count = 0;
+  for (row = start_row ; row <= end_row ; row++) count += offset[row * head.grid_width + end_col + 1] - offset[row * head.grid_width + start_col];
+
+  if (!count || (list = (PING_RANGE *) malloc (count * sizeof (PING_RANGE))) == NULL)
+    {
+      free (offset);
+      fclose (idx_fp);
+      return (count ? -1 : 0);
+    }
+
+
+  /*  The cells in a row are contiguous in the file so we can read each row's ranges with one read.  */
+
+  count = 0;
+  for (row = start_row ; row <= end_row ; row++)
+    {
+      i = offset[row * head.grid_width + start_col];
+      j = offset[row * head.grid_width + end_col + 1];
+
+      if (j > i)
+        {
+          fseeko (idx_fp, sizeof (HOF_INDEX_HEADER) + (cells + 1) * sizeof (int32_t) + (off_t) i * sizeof (PING_RANGE), SEEK_SET);
+          if (fread (&list[count], sizeof (PING_RANGE), j - i, idx_fp) != (size_t) (j - i))
+            {
+              free (list);
+              free (offset);
+              fclose (idx_fp);
+              return (-1);
+            }
+          count += j - i;
+        }
+    }
+
+  free (offset);
+  fclose (idx_fp);
+
+  for (i = 0 ; i < count ; i++)
+    {
+      if (list[i].start < 1 || list[i].start > list[i].end || list[i].end > head.records)
+        {
+          free (list);
+          return (-1);
+        }
+    }
+
+
+  /*  Sort and merge overlapping or adjacent ranges so each record is only read once.  */
+
+  qsort (list, count, sizeof (PING_RANGE), compare_ranges);
+
+  merged = 0;
+  for (i = 1 ; i < count ; i++)
+    {
+      if (list[i].start <= list[merged].end + 1)
+        {
+          if (list[i].end > list[merged].end) list[merged].end = list[i].end;
+        }
+      else
+        {
+          list[++merged] = list[i];
+        }
+    }
+
+  *ranges = list;
+
+  return (merged + 1);
+}
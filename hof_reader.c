@@ -0,0 +1,340 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+#include <stddef.h>
+
+
+/*  hof_read_record decodes (and, on the wrong endian machine, byte swaps) the whole HYDRO_OUTPUT_T for every record but  */
+/*  the filters in get_waveforms only look at a handful of fields and most records don't make it past them.  This reads  */
+/*  a block of raw records at a time and pulls just the HOF_FIELDS out of each one.  The records are only decoded  */
+/*  completely (hof_read_full) for the shots that make it to process_waveforms.  When the first block of a file is  */
+/*  read, records spread across the whole file are checked against hof_read_record to find out whether the raw  */
+/*  records are the same as the decoded ones, the same except for the byte order, or something else.  If they don't  */
+/*  all agree, or it's something else, we just use hof_read_record for everything.  */
+
+#define HOF_BLOCK_RECORDS    512
+#define HOF_CHECK_RECORDS    8
+
+#define HOF_RAW_UNKNOWN      0            /*  Not checked yet  */
+#define HOF_RAW_EXACT        1            /*  Raw records are identical to the decoded records  */
+#define HOF_RAW_NATIVE       2            /*  The fields we want are in native byte order  */
+#define HOF_RAW_SWAPPED      3            /*  The fields we want are byte swapped  */
+#define HOF_RAW_NONE         4            /*  Use hof_read_record  */
+
+
+/*  Copy one field out of a raw record into the same field of a HYDRO_OUTPUT_T, swapping the bytes if needed.  */
+
+#define PROJECT_FIELD(hof, raw, field, swap) \
+  memcpy (&(hof)->field, (raw) + offsetof (HYDRO_OUTPUT_T, field), sizeof ((hof)->field)); \
+  if (swap) swap_field (&(hof)->field, sizeof ((hof)->field))
+
+
+static void swap_field (void *field, int32_t size)
+{
+  uint8_t        *ptr = (uint8_t *) field, tmp;
+  int32_t        i;
+
+
+  for (i = 0 ; i < size / 2 ; i++)
+    {
+      tmp = ptr[i];
+      ptr[i] = ptr[size - 1 - i];
+      ptr[size - 1 - i] = tmp;
+    }
+}
+
+
+
+/*  Project the filter fields of one raw record.  Only those fields of hof are set.  */
+
+static void project_record (uint8_t *raw, uint8_t swap, HYDRO_OUTPUT_T *hof)
+{
+  PROJECT_FIELD (hof, raw, timestamp, swap);
+  PROJECT_FIELD (hof, raw, latitude, swap);
+  PROJECT_FIELD (hof, raw, longitude, swap);
+  PROJECT_FIELD (hof, raw, correct_depth, swap);
+  PROJECT_FIELD (hof, raw, correct_sec_depth, swap);
+  PROJECT_FIELD (hof, raw, abdc, swap);
+  PROJECT_FIELD (hof, raw, sec_abdc, swap);
+}
+
+
+
+static void copy_fields (HYDRO_OUTPUT_T *hof, HOF_FIELDS *fields)
+{
+  fields->timestamp = hof->timestamp;
+  fields->latitude = hof->latitude;
+  fields->longitude = hof->longitude;
+  fields->correct_depth = hof->correct_depth;
+  fields->correct_sec_depth = hof->correct_sec_depth;
+  fields->abdc = hof->abdc;
+  fields->sec_abdc = hof->sec_abdc;
+}
+
+
+
+/*  Do the projected fields of two records match exactly?  */
+
+static uint8_t same_fields (HYDRO_OUTPUT_T *a, HYDRO_OUTPUT_T *b)
+{
+  return (!memcmp (&a->timestamp, &b->timestamp, sizeof (a->timestamp)) &&
+          !memcmp (&a->latitude, &b->latitude, sizeof (a->latitude)) &&
+          !memcmp (&a->longitude, &b->longitude, sizeof (a->longitude)) &&
+          !memcmp (&a->correct_depth, &b->correct_depth, sizeof (a->correct_depth)) &&
+          !memcmp (&a->correct_sec_depth, &b->correct_sec_depth, sizeof (a->correct_sec_depth)) &&
+          !memcmp (&a->abdc, &b->abdc, sizeof (a->abdc)) && !memcmp (&a->sec_abdc, &b->sec_abdc, sizeof (a->sec_abdc)));
+}
+
+
+
+/*  Which ways of reading the raw record give the same fields as hof_read_record?  Returns a mask of 1 << HOF_RAW_...  */
+
+static int32_t raw_modes (uint8_t *raw, HYDRO_OUTPUT_T *full)
+{
+  HYDRO_OUTPUT_T projected;
+  int32_t        mask = 0;
+
+
+  memset (&projected, 0, sizeof (HYDRO_OUTPUT_T));
+
+  if (!memcmp (raw, full, sizeof (HYDRO_OUTPUT_T))) mask |= 1 << HOF_RAW_EXACT;
+
+  project_record (raw, NVFalse, &projected);
+  if (same_fields (&projected, full)) mask |= 1 << HOF_RAW_NATIVE;
+
+  project_record (raw, NVTrue, &projected);
+  if (same_fields (&projected, full)) mask |= 1 << HOF_RAW_SWAPPED;
+
+  return (mask);
+}
+
+
+
+/*  Compare the first record of the first block and HOF_CHECK_RECORDS records spread from the start to the end of the  */
+/*  file with what hof_read_record gives us.  We only use a mode that every one of them agrees with (a record that  */
+/*  is all zeros, for instance, agrees with all of them), otherwise we use hof_read_record for everything.  */
+
+static void check_raw_format (HOF_READER *reader)
+{
+  HYDRO_OUTPUT_T full;
+  uint8_t        raw[sizeof (HYDRO_OUTPUT_T)];
+  struct stat    hof_stat;
+  int32_t        i, rec, records = 0, mask;
+
+
+  charts_read_hof (reader->fp, reader->first, &reader->full);
+  reader->full_rec = reader->first;
+
+  mask = raw_modes (reader->raw, &reader->full);
+
+  if (!fstat (fileno (reader->fp), &hof_stat)) records = (int32_t) ((hof_stat.st_size - HOF_HEAD_SIZE) / sizeof (HYDRO_OUTPUT_T));
+
+  for (i = 0 ; i < HOF_CHECK_RECORDS && mask && records > 1 ; i++)
+    {
+      rec = 1 + (int32_t) ((int64_t) (records - 1) * i / (HOF_CHECK_RECORDS - 1));
+
+      if (rec == reader->first) continue;
+
+      if (fseeko (reader->fp, HOF_HEAD_SIZE + (off_t) (rec - 1) * sizeof (HYDRO_OUTPUT_T), SEEK_SET) ||
+          fread (raw, sizeof (HYDRO_OUTPUT_T), 1, reader->fp) != 1)
+        {
+          mask = 0;
+          break;
+        }
+
+      charts_read_hof (reader->fp, rec, &full);
+
+      mask &= raw_modes (raw, &full);
+    }
+
+  if (mask & (1 << HOF_RAW_EXACT))
+    {
+      reader->mode = HOF_RAW_EXACT;
+    }
+  else if (mask & (1 << HOF_RAW_NATIVE))
+    {
+      reader->mode = HOF_RAW_NATIVE;
+    }
+  else if (mask & (1 << HOF_RAW_SWAPPED))
+    {
+      reader->mode = HOF_RAW_SWAPPED;
+    }
+  else
+    {
+      reader->mode = HOF_RAW_NONE;
+    }
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        open_hof_reader                                     *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Set up a block reader on an open HOF file.          *
+*                                                                           *
+*   Arguments:          reader         - the reader                         *
+*                       fp             - HOF file opened with open_hof_file *
+*                                                                           *
+*   Returns:            NVFalse if we're out of memory                      *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t open_hof_reader (HOF_READER *reader, FILE *fp)
+{
+  memset (reader, 0, sizeof (HOF_READER));
+
+  reader->fp = fp;
+  reader->mode = HOF_RAW_UNKNOWN;
+  reader->full_rec = -1;
+
+  reader->raw = (uint8_t *) malloc (HOF_BLOCK_RECORDS * sizeof (HYDRO_OUTPUT_T));
+  reader->fields = (HOF_FIELDS *) malloc (HOF_BLOCK_RECORDS * sizeof (HOF_FIELDS));
+
+  if (reader->raw == NULL || reader->fields == NULL)
+    {
+      close_hof_reader (reader);
+      return (NVFalse);
+    }
+
+  return (NVTrue);
+}
+
+
+
+void close_hof_reader (HOF_READER *reader)
+{
+  free (reader->raw);
+  free (reader->fields);
+  reader->raw = NULL;
+  reader->fields = NULL;
+}
+
+
+
+/*  Read the block of records starting at rec (but not past end) and project the fields of all of them.  */
+
+static void read_block (HOF_READER *reader, int32_t rec, int32_t end)
+{
+  HYDRO_OUTPUT_T hof;
+  int32_t        i, count;
+  uint8_t        swap;
+
+
+  count = end - rec + 1;
+  if (count > HOF_BLOCK_RECORDS) count = HOF_BLOCK_RECORDS;
+
+  reader->first = rec;
+  reader->count = 0;
+
+  if (reader->mode != HOF_RAW_NONE)
+    {
+      if (!fseeko (reader->fp, HOF_HEAD_SIZE + (off_t) (rec - 1) * sizeof (HYDRO_OUTPUT_T), SEEK_SET))
+        reader->count = fread (reader->raw, sizeof (HYDRO_OUTPUT_T), count, reader->fp);
+
+      if (reader->count && reader->mode == HOF_RAW_UNKNOWN) check_raw_format (reader);
+    }
+
+
+  /*  If we can't use the raw records (or couldn't read them) fall back to hof_read_record.  */
+
+  if (reader->mode == HOF_RAW_NONE || !reader->count)
+    {
+      memset (&hof, 0, sizeof (HYDRO_OUTPUT_T));
+
+      for (i = 0 ; i < count ; i++)
+        {
+          charts_read_hof (reader->fp, rec + i, &hof);
+          copy_fields (&hof, &reader->fields[i]);
+        }
+
+      reader->count = count;
+      reader->full_rec = rec + count - 1;
+      reader->full = hof;
+
+      return;
+    }
+
+  swap = (reader->mode == HOF_RAW_SWAPPED);
+
+  for (i = 0 ; i < reader->count ; i++)
+    {
+      project_record (reader->raw + (size_t) i * sizeof (HYDRO_OUTPUT_T), swap, &hof);
+      copy_fields (&hof, &reader->fields[i]);
+    }
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        hof_read_fields                                     *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Get the filter fields of a HOF record.  Records     *
+*                       are read in blocks so this is meant to be called    *
+*                       with increasing record numbers.                     *
+*                                                                           *
+*   Arguments:          reader         - the reader                         *
+*                       rec            - record number (from 1)             *
+*                       end            - last record that will be wanted    *
+*                                        from this run of records           *
+*                                                                           *
+*   Returns:            The fields (valid until the next call)              *
+*                                                                           *
+\***************************************************************************/
+
+HOF_FIELDS *hof_read_fields (HOF_READER *reader, int32_t rec, int32_t end)
+{
+  if (rec < reader->first || rec >= reader->first + reader->count) read_block (reader, rec, end);
+
+  return (&reader->fields[rec - reader->first]);
+}
+
+
+
+/*  Fully decode a record, the same as hof_read_record.  */
+
+void hof_read_full (HOF_READER *reader, int32_t rec, HYDRO_OUTPUT_T *hof)
+{
+  if (reader->mode == HOF_RAW_EXACT && rec >= reader->first && rec < reader->first + reader->count)
+    {
+      memcpy (hof, reader->raw + (size_t) (rec - reader->first) * sizeof (HYDRO_OUTPUT_T), sizeof (HYDRO_OUTPUT_T));
+      return;
+    }
+
+  if (rec == reader->full_rec)
+    {
+      *hof = reader->full;
+      return;
+    }
+
+  charts_read_hof (reader->fp, rec, hof);
+  reader->full = *hof;
+  reader->full_rec = rec;
+}
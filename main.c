@@ -46,196 +46,208 @@ OPTIONS                options;
 void usage ()
 {
   fprintf (stderr, "\nUsage: pfm_waveform PFM_FILE AREA_FILE\n");
+  fprintf (stderr, "   or: pfm_waveform -s SOCKET [-j MAX_ACTIVE] [-q MAX_WAITING] PFM_FILE\n");
+  fprintf (stderr, "   or: pfm_waveform -i PFM_FILE AREA_FILE\n");
+  fprintf (stderr, "   or: pfm_waveform -l HOF_LIST AREA_FILE\n");
+  fprintf (stderr, "   or: pfm_waveform -b PFM_FILE | -b -l HOF_LIST\n");
+  fprintf (stderr, "   or: pfm_waveform -S K/N [-F FILE_NUMBERS] PFM_FILE AREA_FILE\n");
+  fprintf (stderr, "   or: pfm_waveform -t START,END [-t START,END ...] PFM_FILE AREA_FILE\n");
+  fprintf (stderr, "   or: pfm_waveform -u PFM_FILE AREA_FILE\n");
+  fprintf (stderr, "   or: pfm_waveform -g [-T THREADS] PFM_FILE AREA_FILE\n");
+  fprintf (stderr, "   or: pfm_waveform -M N AREA_FILE\n");
   fprintf (stderr, "\nWhere:\n\n");
   fprintf (stderr, "\tPFM_FILE = PFM file (required)\n\n");
-  fprintf (stderr, "\tAREA_FILE = Area file (required)\n\n");
+  fprintf (stderr, "\tAREA_FILE = Area file (required unless -s or -b is used)\n\n");
   fprintf (stderr, "\t\tThe area file names must have a .ARE extension\n");
   fprintf (stderr, "\t\tfor ISS60 type area files, a .are extension for generic area files, or\n");
-  fprintf (stderr, "\t\ta .afs extension for Army Corps area files.\n\n");
+  fprintf (stderr, "\t\ta .afs extension for Army Corps area files.  Generic and Army Corps area\n");
+  fprintf (stderr, "\t\tfiles may have any number of points and may have more than one ring (a line\n");
+  fprintf (stderr, "\t\tstarting with RING starts a new ring, blank lines are ignored).  Rings inside\n");
+  fprintf (stderr, "\t\tother rings are holes.  ISS60 area files may also have any number of points.\n\n");
+  fprintf (stderr, "\t-s = run as a resident query server listening on Unix domain socket SOCKET.\n");
+  fprintf (stderr, "\t\tThe PFM stays open between queries.  Each connection sends \"lat lon\" lines in\n");
+  fprintf (stderr, "\t\tdecimal degrees (RING lines separate rings) followed by an END line and gets\n");
+  fprintf (stderr, "\t\tthe results back followed by a \"DONE count\" line (or an ERROR or BUSY line).\n");
+  fprintf (stderr, "\t\tLines may be up to 254 characters long and a connection that goes 60 seconds\n");
+  fprintf (stderr, "\t\twithout sending anything before its END line is dropped.\n");
+  fprintf (stderr, "\t-j = maximum number of queries to run at the same time in server mode (default 4)\n");
+  fprintf (stderr, "\t-q = maximum number of connections allowed to wait (or send their area) before new\n");
+  fprintf (stderr, "\t\tconnections are answered with BUSY (default 16)\n");
+  fprintf (stderr, "\t-i = get the candidate records from the sidecar spatial index (.hix) of each HOF\n");
+  fprintf (stderr, "\t\tfile instead of scanning the PFM bins.  Missing or out of date indexes are\n");
+  fprintf (stderr, "\t\tbuilt as needed.  A file whose index can't be built or read is scanned in full.\n");
+  fprintf (stderr, "\t-l = use the HOF files named (one per line) in HOF_LIST instead of the PFM\n");
+  fprintf (stderr, "\t\tinput files (implies -i, no PFM_FILE is needed)\n");
+  fprintf (stderr, "\t-b = build (or rebuild) the sidecar spatial indexes for the HOF files and exit\n");
+  fprintf (stderr, "\t-S = run shard K of N.  Only input files whose number modulo N is K - 1 are\n");
+  fprintf (stderr, "\t\textracted (unless -F is used).  The partial output goes to\n");
+  fprintf (stderr, "\t\tAREA.shard_K_of_N.pts and, when the shard finishes, a manifest is written to\n");
+  fprintf (stderr, "\t\tAREA.shard_K_of_N.man.  A failed shard can simply be run again.\n");
+  fprintf (stderr, "\t-F = only extract from these PFM input file numbers (e.g. 0,3,10-20)\n");
+  fprintf (stderr, "\t-M = merge the output of N completed shards into AREA.pts.  The result is the\n");
+  fprintf (stderr, "\t\tsame as a single run over all of the files.  The shards must all have been run\n");
+  fprintf (stderr, "\t\twith the same PFM, area, and time windows and must cover every input file.\n");
+  fprintf (stderr, "\t-p = number of input files to read ahead of the extraction (default 2, 0 turns\n");
+  fprintf (stderr, "\t\tread-ahead off)\n");
+  fprintf (stderr, "\t-t = only extract shots whose HOF timestamp is between START and END (inclusive).\n");
+  fprintf (stderr, "\t\tThe times are UTC, either seconds from 01/01/1970 or YYYY-MM-DDTHH:MM:SS[.ssssss].\n");
+  fprintf (stderr, "\t\tMay be used more than once (a shot in any of the windows is extracted).\n");
+  fprintf (stderr, "\t-m, --max-memory = memory budget (e.g. 512M or 4G).  The bin scan reads fewer bins at\n");
+  fprintf (stderr, "\t\ta time, large area indexes fall back to testing every edge, HOF index building\n");
+  fprintf (stderr, "\t\tre-reads the positions instead of holding them, and read-ahead is limited to the\n");
+  fprintf (stderr, "\t\tbudget and dropped from the page cache as soon as each file is done.\n");
+  fprintf (stderr, "\t-u, --update = bring AREA.pts up to date after the PFM has been edited.  The first run\n");
+  fprintf (stderr, "\t\twrites AREA.state along with the output.  After that the bins are scanned again but\n");
+  fprintf (stderr, "\t\tonly records that weren't in the old output are extracted.  The output and the count\n");
+  fprintf (stderr, "\t\tare the same as a full run.\n");
+  fprintf (stderr, "\t-g, --grid = write per bin statistics to AREA.wgd instead of a line per shot to\n");
+  fprintf (stderr, "\t\tAREA.pts.  For each PFM bin covering the area it has the number of shots and, for\n");
+  fprintf (stderr, "\t\tthe PMT and APD channels, the number of qualifying runs, their mean rise and\n");
+  fprintf (stderr, "\t\tlength, and the fraction of shots with a second run (binary, native byte order).\n");
+  fprintf (stderr, "\t-T, --threads = number of files to extract at the same time in grid mode (default 4)\n");
+  fprintf (stderr, "\t-r, --resume = keep a checkpoint (AREA.ckpt, or AREA.shard_K_of_N.ckpt) so the run\n");
+  fprintf (stderr, "\t\tcan be picked up where it left off.  The checkpoint is written after an input\n");
+  fprintf (stderr, "\t\tfile is finished, at most every 30 seconds.  Running again with -r skips the\n");
+  fprintf (stderr, "\t\tfiles that were finished and continues the output.  If the checkpoint doesn't\n");
+  fprintf (stderr, "\t\tmatch the run or the output it starts from scratch.\n\n");
+  fprintf (stderr, "\tAREA.pts has one comma separated line per good shot, in input file and record order:\n");
+  fprintf (stderr, "\t\tlatitude, longitude, PFM input file number, HOF record number, and then for\n");
+  fprintf (stderr, "\t\teach of the PMT, APD, IR, and Raman channels the number of qualifying runs (0\n");
+  fprintf (stderr, "\t\tto 2) followed by start, rise, run, max slope, max curvature, and inflections\n");
+  fprintf (stderr, "\t\tfor run 1 and then for run 2 (zeros if there's no such run), 56 columns in all.\n\n");
   fflush (stderr);
 }
 
 
 
-int32_t get_waveforms (char *path, double *polygon_x, double *polygon_y, int32_t polygon_count,
-                        int32_t start, int32_t end, int32_t total, FILE *txt_fp, char *areafile __attribute__ ((unused)))
+int32_t main (int32_t argc, char **argv)
 {
-  FILE                   *data_fp, *wave_fp;
-  POS_OUTPUT_T           pos;
-  WAVE_HEADER_T          wave_header;
-  WAVE_DATA_T            wave_data;
-  int64_t                new_stamp, data_timestamp;
-  int32_t                i;
-  uint8_t                good_rec;
-  static HYDRO_OUTPUT_T  hof;
-  static int32_t         count = 0, percent = 0, old_percent = -1, good_count = 0, bad_count = 0;
-  char                   wave_file[512], pos_file[512];
-  static FILE            *pos_fp = NULL;
-  /*
-  static int32_t         sum_count = 0;
-  static double          sum = 0.0;
-  */
-
-  uint8_t process_waveforms (HYDRO_OUTPUT_T *, WAVE_HEADER_T *, WAVE_DATA_T *, FILE *, int32_t);
+  int32_t                i, icount, shard = 0, shard_count = 0, merge_count = 0;
+  char                   pfm_file[512], areafile[512], txt_file[512], socket_path[512], list_file[512], manifest_file[512];
+  char                   state_file[512], checkpoint_file[512];
+  GRID                   grid;
+  char                   c;
+  uint8_t                server = NVFalse, build = NVFalse, hof_list = NVFalse, update = NVFalse, gridded = NVFalse;
+  uint8_t                resume = NVFalse;
+  QUERY                  query;
+  extern char            *optarg;
+  extern int             optind;
+  static struct option   long_options[] = {{"max-memory", required_argument, NULL, 'm'},
+                                           {"update", no_argument, NULL, 'u'},
+                                           {"grid", no_argument, NULL, 'g'},
+                                           {"threads", required_argument, NULL, 'T'},
+                                           {"resume", no_argument, NULL, 'r'},
+                                           {NULL, 0, NULL, 0}};
 
-  strcpy (wave_file, path);
-  strcpy (&wave_file[strlen (wave_file) - 4], ".inh");
-  fprintf(stderr,"%s %s %d %s\n",__FILE__,__FUNCTION__,__LINE__,path);
 
-  wave_fp = open_wave_file (wave_file);
+  printf ("\n\n %s \n\n\n", VERSION);
 
-  if (wave_fp == NULL) return (0);
 
-  wave_read_header (wave_fp, &wave_header);
+  memset (&query, 0, sizeof (QUERY));
 
+  options.max_active = 4;
+  options.max_waiting = 16;
+  options.prefetch_depth = 2;
+  options.grid_threads = 4;
 
-  if ((data_fp = open_hof_file (path)) == NULL)
+  while ((c = getopt_long (argc, argv, "ns:j:q:ibl:S:F:M:p:t:m:ugT:r", long_options, NULL)) != EOF)
     {
-      perror (path);
-      exit (-1);
-    }
+      switch (c)
+        {
+        case 'n':
+          /*  Placeholder  */
+          break;
 
-  for (i = start ; i <= end ; i++)
-    {
-      /*  Find the record based on the timestamp from the hof file.  */
+        case 's':
+          strcpy (socket_path, optarg);
+          server = NVTrue;
+          break;
 
-      hof_read_record (data_fp, i, &hof);
-      data_timestamp = hof.timestamp;
+        case 'j':
+          sscanf (optarg, "%d", &options.max_active);
+          if (options.max_active < 1) options.max_active = 1;
+          break;
 
+        case 'q':
+          sscanf (optarg, "%d", &options.max_waiting);
+          if (options.max_waiting < 0) options.max_waiting = 0;
+          break;
 
-      if (hof.correct_depth != -998.0)
-        {
-          if (wave_read_record (wave_fp, i, &wave_data))
-            {
-              /*  Find, open, and read the sbet (reprocessed) or pos file information.  */
-
-              if (pos_fp != NULL)
-                {
-                  fclose (pos_fp);
-                  pos_fp = NULL;
-                }
-
-              if (!get_pos_file (path, pos_file))
-                {
-                  fprintf (stderr, "Unable to find pos/sbet file for hof file %s\n", path);
-                  fflush (stderr);
-                }
-              else
-                {
-                  if ((pos_fp = open_pos_file (pos_file)) == NULL)
-                    {
-                      fprintf (stderr, "Unable to open pos/sbet file for hof file %s\n", path);
-                      fflush (stderr);
-                    }
-                  else
-                    {
-                      /*  Get the attitude data for this shot.  */
-
-                      new_stamp = pos_find_record (pos_fp, &pos, data_timestamp);
-
-                      if (!new_stamp) 
-                        {
-                          fprintf (stderr, "\n\nUnable to get timestamp ");
-                          fprintf (stderr, "%"PRId64, data_timestamp);
-                          fprintf (stderr, " for pos/sbet file %s\n", pos_file);
-                          fprintf (stderr, "This usually indicates that the above pos/sbet file is FUBAR or the name is incorrect!\n");
-                          fprintf (stderr, "Make sure the file name conforms to the naming convention (_YYMMDD_NNNN.out or .pos) and\n");
-                          fprintf (stderr, "check the start and end times of this file (dump_pos) against the data in the HOF/TOF/IMG files.\n\n\n");
-
-                          bad_count++;
-
-                          if (bad_count > 100) exit (-1);
-                        }
-                      else
-                        {
-                          good_rec = NVFalse;
-                          /*
-                          if (hof.abdc > 70 && hof.correct_sec_depth != -998.0 && hof.kgps_sec_elev > 0.0)
-                            {
-                              fprintf (stderr, "%s %s %d %d %d %f %f %f\n", __FILE__, __FUNCTION__, __LINE__, hof.bot_bin_first, hof.bot_bin_second,
-                                       hof.kgps_res_elev, hof.kgps_sec_elev, (hof.kgps_res_elev - hof.kgps_sec_elev) /
-                                       (double) (hof.bot_bin_first - hof.bot_bin_second));
-                              sum += (hof.kgps_res_elev - hof.kgps_sec_elev) / (double) (hof.bot_bin_first - hof.bot_bin_second);
-                              sum_count++;
-                            }
-                          */
-
-                          if (hof.abdc > 70 || (hof.correct_sec_depth != -998.0 && hof.sec_abdc > 70))
-                            {
-                              /*  Assume GCS was right if it picked two returns.  */
-
-                              if (hof.correct_depth == -998.0 || hof.correct_sec_depth == -998.0)
-                                {
-                                  /*  Make sure we're inside the area we specified.  */
-
-                                  if (inside_polygon2 (polygon_x, polygon_y, polygon_count, hof.longitude, hof.latitude))
-                                    {
-                                      /*  Get the altitude and other stuff.  */
-
-                                      /*fprintf (txt_fp, "%.11f, %.11f, %f, %f, %d, %f\n", hof.latitude, hof.longitude, hof.kgps_res_elev, pos.altitude,
-                                        hof.bot_bin_first, (pos.altitude - hof.kgps_res_elev) / (double) hof.bot_bin_first);*/
-
-                                      good_rec = NVTrue;
-                                      good_count++;
-                                    }
-                                }
-                            }
-
-                          /*55213 & 26990 & 26706*/
-                          if (good_rec && (i == 54150)/* || i == 26990)*/) process_waveforms (&hof, &wave_header, &wave_data, txt_fp, i);
-                        }
-                    }
-                }
-            }
-        }
+        case 'p':
+          sscanf (optarg, "%d", &options.prefetch_depth);
+          if (options.prefetch_depth < 0) options.prefetch_depth = 0;
+          break;
 
-      count++;
-      percent = ((float) count / (float) total) * 100.0;
-      if (percent != old_percent)
-        {
-          old_percent = percent;
-          fprintf (stderr, "%03d%% processed            \r", percent);
-          fflush (stderr);
-        }
-    }
+        case 'i':
+          options.use_index = NVTrue;
+          break;
 
+        case 'b':
+          build = NVTrue;
+          break;
 
-  fclose (wave_fp);
-  fclose (data_fp);
+        case 'l':
+          strcpy (list_file, optarg);
+          hof_list = NVTrue;
+          options.use_index = NVTrue;
+          break;
 
-  /* 0.106795
-  fprintf(stderr,"%s %s %d %d %f\n",__FILE__,__FUNCTION__,__LINE__,sum_count, sum / (double) sum_count);*/
+        case 'S':
+          if (!parse_shard (optarg, &shard, &shard_count))
+            {
+              fprintf (stderr, "\n\nBad shard specification %s\n\n", optarg);
+              exit (-1);
+            }
+          break;
 
-  return (good_count);
-}
+        case 'F':
+          if (!parse_file_numbers (optarg))
+            {
+              fprintf (stderr, "\n\nBad file number list %s\n\n", optarg);
+              exit (-1);
+            }
+          break;
 
+        case 't':
+          if (!add_time_window (&query, optarg))
+            {
+              fprintf (stderr, "\n\nBad time window %s\n\n", optarg);
+              exit (-1);
+            }
+          break;
 
+        case 'm':
+          if (!parse_memory_size (optarg, &options.max_memory))
+            {
+              fprintf (stderr, "\n\nBad memory size %s\n\n", optarg);
+              exit (-1);
+            }
+          break;
 
-int32_t main (int32_t argc, char **argv)
-{
-  FILE                   *txt_fp;
-  int32_t                i, j, k, polygon_count = 0, x_start, y_start, width, height, total, percent = 0, old_percent = -1, recnum, icount = 0;
-  int16_t                type;
-  NV_I32_COORD2          coord;
-  char                   pfm_file[512], areafile[512], txt_file[512], path[512];
-  char                   c;
-  double                 polygon_x[200], polygon_y[200];
-  LIST_NUM               list[10000];
-  BIN_RECORD             bin;
-  DEPTH_RECORD           *depth;
-  extern char            *optarg;
-  extern int             optind;
+        case 'u':
+          update = NVTrue;
+          break;
 
+        case 'g':
+          gridded = NVTrue;
+          break;
 
-  printf ("\n\n %s \n\n\n", VERSION);
+        case 'r':
+          resume = NVTrue;
+          break;
 
+        case 'T':
+          sscanf (optarg, "%d", &options.grid_threads);
+          if (options.grid_threads < 1) options.grid_threads = 1;
+          break;
 
-  while ((c = getopt (argc, argv, "n")) != EOF)
-    {
-      switch (c)
-        {
-        case 'n':
-          /*  Placeholder  */
+        case 'M':
+          sscanf (optarg, "%d", &merge_count);
+          if (merge_count < 1)
+            {
+              usage ();
+              exit (-1);
+            }
           break;
 
         default:
@@ -248,153 +260,260 @@ int32_t main (int32_t argc, char **argv)
 
   /* Make sure we got the mandatory file name arguments.  */
 
-  if (optind >= argc)
+  if (argc - optind < (!hof_list && !merge_count) + (!server && !build))
     {
       usage ();
       exit (-1);
     }
 
 
-  strcpy (pfm_file, argv[optind]);
-  strcpy (areafile, argv[optind + 1]);
- 
+  /*  Updates need the PFM bins and the whole output.  */
 
-  get_area_mbr (areafile, &polygon_count, polygon_x, polygon_y, &options.mbr);
+  if (update && (server || build || merge_count || shard_count || options.use_index))
+    {
+      fprintf (stderr, "\n\n-u can't be used with -s, -b, -i, -l, -S, or -M\n\n");
+      exit (-1);
+    }
 
-  strcpy (options.open_args.list_path, argv[optind]);
 
-  options.open_args.checkpoint = 0;
-  options.pfm_handle = open_existing_pfm_file (&options.open_args);
+  /*  The grid is laid over the PFM bins and replaces the whole output.  */
 
-  if (options.pfm_handle < 0) pfm_error_exit (pfm_error);
+  if (gridded && (server || build || merge_count || shard_count || update || hof_list))
+    {
+      fprintf (stderr, "\n\n-g can't be used with -s, -b, -l, -S, -M, or -u\n\n");
+      exit (-1);
+    }
 
 
-  x_start = 0;
-  y_start = 0;
-  width = options.open_args.head.bin_width;
-  height = options.open_args.head.bin_height;
+  /*  Only plain and shard extractions write checkpoints.  */
 
-  if (options.mbr.min_y > options.open_args.head.mbr.max_y || options.mbr.max_y < options.open_args.head.mbr.min_y ||
-      options.mbr.min_x > options.open_args.head.mbr.max_x || options.mbr.max_x < options.open_args.head.mbr.min_x)
+  if (resume && (server || build || merge_count || update || gridded))
     {
-      fprintf (stderr, "\n\nSpecified area is completely outside of the PFM bounds!\n\n");
+      fprintf (stderr, "\n\n-r can't be used with -s, -b, -M, -u, or -g\n\n");
       exit (-1);
     }
 
 
-  /*  Match to nearest cell.  */
+  /*  Merging shards doesn't need the PFM.  */
+
+  if (merge_count)
+    {
+      if ((icount = merge_shards (argv[optind], merge_count)) < 0) exit (-1);
+
+      fprintf (stderr, "Merged %d waveforms from %d shards\n\n", icount, merge_count);
+      fflush (stderr);
+      exit (0);
+    }
 
-  x_start = NINT ((options.mbr.min_x - options.open_args.head.mbr.min_x) / options.open_args.head.x_bin_size_degrees);
-  y_start = NINT ((options.mbr.min_y - options.open_args.head.mbr.min_y) / options.open_args.head.y_bin_size_degrees);
-  width = NINT ((options.mbr.max_x - options.mbr.min_x) / options.open_args.head.x_bin_size_degrees);
-  height = NINT ((options.mbr.max_y - options.mbr.min_y) / options.open_args.head.y_bin_size_degrees);
 
+  pthread_mutex_init (&options.pfm_mutex, NULL);
+  pthread_mutex_init (&options.pos_mutex, NULL);
 
-  /*  Adjust to PFM bounds if necessary.  */
+  if (hof_list)
+    {
+      if (load_file_list (list_file) <= 0)
+        {
+          fprintf (stderr, "\n\nNo HOF files in %s\n\n", list_file);
+          exit (-1);
+        }
 
-  if (x_start < 0) x_start = 0;
-  if (y_start < 0) y_start = 0;
-  if (x_start + width > options.open_args.head.bin_width) width = options.open_args.head.bin_width - x_start;
-  if (y_start + height > options.open_args.head.bin_height) height = options.open_args.head.bin_height - y_start;
+      options.pfm_handle = -1;
+    }
+  else
+    {
+      strcpy (pfm_file, argv[optind++]);
 
+      strcpy (options.open_args.list_path, pfm_file);
 
-  /*  Open the output file.  */
+      options.open_args.checkpoint = 0;
+      options.pfm_handle = open_existing_pfm_file (&options.open_args);
 
-  strcpy (txt_file, pfm_basename (areafile));
-  strcpy (&txt_file[strlen (txt_file) - 4], ".pts");
+      if (options.pfm_handle < 0) pfm_error_exit (pfm_error);
 
-  if ((txt_fp = fopen (txt_file, "w")) == NULL) 
+      load_file_index ();
+    }
+
+
+  /*  If we're running a shard without an explicit file list take every Nth file.  */
+
+  if (shard_count && options.file_mask == NULL)
     {
-      perror (txt_file);
+      if ((options.file_mask = (uint8_t *) calloc (MAX_PFM_FILES, sizeof (uint8_t))) == NULL)
+        {
+          perror ("Allocating file mask");
+          exit (-1);
+        }
+
+      for (i = 0 ; i < MAX_PFM_FILES ; i++) options.file_mask[i] = (i % shard_count == shard - 1);
+    }
+
+
+  if (build)
+    {
+      for (i = 0 ; i < options.file_count ; i++)
+        {
+          if (options.file_index[i].type == PFM_CHARTS_HOF_DATA)
+            {
+              fprintf (stderr, "Indexing %s\n", options.file_index[i].path);
+              fflush (stderr);
+
+              if (!build_hof_index (options.file_index[i].path, NVTrue)) exit (-1);
+            }
+        }
+
+      if (options.pfm_handle >= 0) close_pfm_file (options.pfm_handle);
+      exit (0);
+    }
+
+
+  if (server)
+    {
+      run_server (socket_path);
+      if (options.pfm_handle >= 0) close_pfm_file (options.pfm_handle);
       exit (-1);
     }
 
 
-  /*  Set all hits to false.  */
+  strcpy (areafile, argv[optind]);
 
-  for (i = 0 ; i < 10000 ; i++)
+  if (!read_area (areafile, &query.area))
     {
-      list[i].hit = NVFalse;
-      list[i].start = UINT32_MAX;
-      list[i].end = 0;
+      fprintf (stderr, "\n\nUnable to read area file %s\n\n", areafile);
+      exit (-1);
     }
 
+  build_area_index (&query.area);
 
-  /*  Double loop over height & width of area  */
+  if (!reserve_memory (MAX_PFM_FILES * sizeof (LIST_NUM), NVFalse))
+    {
+      fprintf (stderr, "\n\nThe file list doesn't fit in the memory budget\n\n");
+      exit (-1);
+    }
 
-  for (i = y_start ; i < y_start + height ; i++)
+  if ((query.list = (LIST_NUM *) calloc (MAX_PFM_FILES, sizeof (LIST_NUM))) == NULL)
     {
-      coord.y = i;
-      for (j = x_start ; j < x_start + width ; j++)
-        {
-          coord.x = j;
+      perror ("Allocating file list");
+      exit (-1);
+    }
 
-          read_bin_record_index (options.pfm_handle, coord, &bin);
 
-          if (bin.num_soundings)
-            {
-              /*  Get file numbers and min and max record numbers in file so we can figure out which   */
-              /*  waveforms to retrieve.  */
-
-              if (!read_depth_array_index (options.pfm_handle, coord, &depth, &recnum))
-                {
-                  for (k = 0 ; k < recnum ; k++)
-                    {
-                      if (!(depth[k].validity & PFM_DELETED))
-                        {
-                          int32_t m = depth[k].file_number;
-
-                          if (m > 10000)
-                            {
-                              fprintf (stderr, "\n\nFile number out of bounds - %d\n\n", depth[k].file_number);
-                              exit (-1);
-                            }
-                          list[m].hit = NVTrue;
-                          if (depth[k].ping_number < list[m].start) list[m].start = depth[k].ping_number;
-                          if (depth[k].ping_number > list[m].end) list[m].end = depth[k].ping_number;
-                        }
-                    }
-                  free (depth);
-                }
-            }
+  /*  Open the output file.  */
+
+  if (shard_count)
+    {
+      shard_file_names (areafile, shard, shard_count, txt_file, manifest_file);
+
+
+      /*  Get rid of any manifest from an earlier (failed) attempt at this shard before we start writing.  */
+
+      remove (manifest_file);
+
+      if (!reserve_memory (MAX_PFM_FILES * sizeof (SEGMENT), NVFalse))
+        {
+          fprintf (stderr, "\n\nThe shard segment list doesn't fit in the memory budget\n\n");
+          exit (-1);
         }
 
-      percent = NINT (((float) (i - y_start) / (float) height) * 100.0);
-      if (percent != old_percent)
+      if ((query.segments = (SEGMENT *) calloc (MAX_PFM_FILES, sizeof (SEGMENT))) == NULL)
         {
-          fprintf (stderr, "%03d%% read\r", percent);
-          fflush (stderr);
-          old_percent = percent;
+          perror ("Allocating segments");
+          exit (-1);
         }
     }
+  else
+    {
+      strcpy (txt_file, pfm_basename (areafile));
+      strcpy (&txt_file[strlen (txt_file) - 4], ".pts");
+    }
+
+  query.progress = NVTrue;
 
 
-  total = 0;
-  for (i = 0 ; i < 10000 ; i++)
+  /*  An update rewrites the output itself when it's done.  */
+
+  if (gridded)
     {
-      if (list[i].hit) total += ((list[i].end - list[i].start) + 1);
-    }
+      strcpy (&txt_file[strlen (txt_file) - 4], ".wgd");
 
+      if (!init_grid (&query, &grid)) exit (-1);
 
-  for (i = 0 ; i < 10000 ; i++)
+      query.grid = &grid;
+
+      if ((icount = extract_area (&query)) < 0 || !write_grid (txt_file, &grid)) exit (-1);
+
+      free_grid (&grid);
+    }
+  else if (update)
     {
-      if (list[i].hit)
+      strcpy (state_file, txt_file);
+      strcpy (&state_file[strlen (state_file) - 4], ".state");
+
+      if ((icount = update_area (&query, pfm_file, txt_file, state_file)) < 0) exit (-1);
+    }
+  else
+    {
+      /*  Checkpoints are only kept with -r.  The output is opened for update (the checkpoints read it back to  */
+      /*  digest it) and extract_area cuts it back to the checkpoint, or empties it if there isn't a usable one.  */
+
+      query.txt_fp = NULL;
+
+      if (resume)
         {
-          read_list_file (options.pfm_handle, (int16_t) i, path, &type);
+          strcpy (checkpoint_file, txt_file);
+          strcpy (&checkpoint_file[strlen (checkpoint_file) - 4], ".ckpt");
 
+          query.checkpoint_file = checkpoint_file;
+          query.checkpoint_key = query_digest (&query, hof_list ? list_file : pfm_file, NVTrue);
+          query.resume = resume;
 
-          /*  Check for HOF data type.  */
+          if ((query.txt_fp = fopen (txt_file, "r+")) == NULL) query.txt_fp = fopen (txt_file, "w+");
+        }
+      else
+        {
+          query.txt_fp = fopen (txt_file, "w");
+        }
 
-          if (type == PFM_CHARTS_HOF_DATA)
-            icount += get_waveforms (path, polygon_x, polygon_y, polygon_count, list[i].start, list[i].end, total, txt_fp, areafile);
+      if (query.txt_fp == NULL)
+        {
+          perror (txt_file);
+          exit (-1);
         }
+
+      if ((icount = extract_area (&query)) < 0) exit (-1);
     }
 
-  fprintf (stderr, "Extracted %d waveforms\n\n", icount);
+  fprintf (stderr, "Extracted %d waveforms\n", icount);
+
+  if (query.cache_pages)
+    fprintf (stderr, "Page cache hit rate %.1f%% (%"PRId64" of %"PRId64" pages, read-ahead depth %d)\n",
+             100.0 * (double) query.cache_resident / (double) query.cache_pages, query.cache_resident, query.cache_pages,
+             options.prefetch_depth);
+
+  report_memory ();
+
+  fprintf (stderr, "\n");
   fflush (stderr);
 
-  close_pfm_file (options.pfm_handle);
-  fclose (txt_fp);
+  if (options.pfm_handle >= 0) close_pfm_file (options.pfm_handle);
+
+  if (query.txt_fp != NULL && fclose (query.txt_fp))
+    {
+      perror (txt_file);
+      exit (-1);
+    }
+
+  if (shard_count && !write_manifest (manifest_file, shard, shard_count, &query, icount,
+                                      query_digest (&query, hof_list ? list_file : pfm_file, NVFalse))) exit (-1);
+
+
+  /*  The run is complete so the checkpoint is no longer needed.  */
+
+  if (query.checkpoint_file != NULL) remove (query.checkpoint_file);
+
+  free_area (&query.area);
+  free (query.list);
+  free (query.segments);
+  free (query.windows);
 
 
   return (0);
@@ -0,0 +1,169 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+#ifndef NVWIN3X
+#include <sys/resource.h>
+#endif
+
+
+/*  Memory budget (--max-memory).  Every structure that grows with the size of the area or the survey (the bin scan  */
+/*  row buffer, the area slab index, the per query file lists and extraction plans, the HOF index, the read-ahead,  */
+/*  the update state, and the grid) asks for its memory here first.  If the request would put us over the budget the  */
+/*  caller uses a smaller or slower alternative instead (fewer grid workers, no read-ahead, and so on) or, when there  */
+/*  is no alternative, stops with a message.  Nothing is allocated here, we only keep count.  With no budget every  */
+/*  request succeeds but we still track the peak.  */
+
+static pthread_mutex_t memory_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int64_t         memory_used = 0, memory_peak = 0;
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        parse_memory_size                                   *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Convert a size with an optional K, M, or G suffix   *
+*                       (powers of 1024) to bytes.                          *
+*                                                                           *
+*   Arguments:          string         - size (e.g. 512M or 2G)             *
+*                       bytes          - returned size in bytes             *
+*                                                                           *
+*   Returns:            NVFalse if the size couldn't be parsed              *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t parse_memory_size (char *string, int64_t *bytes)
+{
+  double         size;
+  char           *end;
+
+
+  size = strtod (string, &end);
+  if (end == string || size <= 0.0) return (NVFalse);
+
+  switch (*end)
+    {
+    case 'g':
+    case 'G':
+      size *= 1024.0;
+      /*  Fall through  */
+
+    case 'm':
+    case 'M':
+      size *= 1024.0;
+      /*  Fall through  */
+
+    case 'k':
+    case 'K':
+      size *= 1024.0;
+      end++;
+      break;
+    }
+
+  if ((*end == 'b' || *end == 'B') && end[1] == 0) end++;
+  if (*end) return (NVFalse);
+
+  *bytes = (int64_t) size;
+
+  return (NVTrue);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        reserve_memory                                      *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Count memory against the budget.                    *
+*                                                                           *
+*   Arguments:          bytes          - amount needed                      *
+*                       force          - count it even if it goes over the  *
+*                                        budget (for things we can't do     *
+*                                        without)                           *
+*                                                                           *
+*   Returns:            NVFalse if it didn't fit (and wasn't counted)       *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t reserve_memory (int64_t bytes, uint8_t force)
+{
+  uint8_t        fits;
+
+
+  if (bytes <= 0) return (NVTrue);
+
+  pthread_mutex_lock (&memory_mutex);
+
+  fits = (!options.max_memory || memory_used + bytes <= options.max_memory);
+
+  if (fits || force)
+    {
+      memory_used += bytes;
+      if (memory_used > memory_peak) memory_peak = memory_used;
+    }
+
+  pthread_mutex_unlock (&memory_mutex);
+
+  return (fits);
+}
+
+
+
+void release_memory (int64_t bytes)
+{
+  if (bytes <= 0) return;
+
+  pthread_mutex_lock (&memory_mutex);
+  memory_used -= bytes;
+  pthread_mutex_unlock (&memory_mutex);
+}
+
+
+
+/*  Report the peak of the counted memory and the peak resident set size of the process against the budget.  */
+
+void report_memory ()
+{
+  double         rss = 0.0;
+
+#ifndef NVWIN3X
+  struct rusage  usage;
+
+
+  /*  ru_maxrss is in kilobytes on Linux.  */
+
+  if (!getrusage (RUSAGE_SELF, &usage)) rss = (double) usage.ru_maxrss / 1024.0;
+#endif
+
+  fprintf (stderr, "Peak RSS %.1f MB, peak budgeted structures %.1f MB", rss, (double) memory_peak / 1048576.0);
+
+  if (options.max_memory) fprintf (stderr, ", budget %.1f MB", (double) options.max_memory / 1048576.0);
+
+  fprintf (stderr, "\n");
+}
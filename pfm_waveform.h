@@ -29,6 +29,7 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <pthread.h>
 #include <proj_api.h>
 
 /*
@@ -48,6 +49,23 @@
 #include "pfm_extras.h"
 
 
+/*  Maximum number of input files that can be referenced by the PFM.  */
+
+#define MAX_PFM_FILES     10000
+
+
+/*  Number of waveform channels (PMT, APD, IR, and Raman) and the number of consecutive rising samples needed for a  */
+/*  qualifying run.  */
+
+#define WAVE_CHANNELS     4
+#define WAVE_RUN_REQ      6
+
+
+/*  Starting value for fnv (the hash in digest.c used for the update state, checkpoint, and shard digests).  */
+
+#define FNV_OFFSET        14695981039346656037ULL
+
+
 typedef struct
 {
   uint8_t       hit;
@@ -56,10 +74,293 @@ typedef struct
 } LIST_NUM;
 
 
+/*  Inclusive range of HOF record numbers.  */
+
 typedef struct
 {
-  double        altitude;
-  PFM_OPEN_ARGS open_args;
-  int32_t       pfm_handle;
-  NV_F64_XYMBR  mbr;
+  int32_t       start;
+  int32_t       end;
+} PING_RANGE;
+
+
+/*  Up to two qualifying runs found in one waveform channel.  */
+
+typedef struct
+{
+  int32_t       count;
+  int32_t       start[2];
+  int32_t       end[2];
+  int32_t       rise[2];
+  int32_t       run[2];
+  float         max_slope[2];             /*  Largest first difference in the run  */
+  float         max_curvature[2];         /*  Largest absolute second difference in the run  */
+  int32_t       inflections[2];           /*  Sign changes of the second difference in the run  */
+} WAVE_RUNS;
+
+
+/*  Fixed size result of process_waveforms for one shot, indexed by PMT, APD, IR, and RAMAN.  */
+
+typedef struct
+{
+  WAVE_RUNS     channel[WAVE_CHANNELS];
+} WAVE_RESULT;
+
+
+/*  Reusable buffer for read_bin_run.  */
+
+typedef struct
+{
+  BIN_RECORD    *bins;
+  int32_t       max_bins;
+  int32_t       width;                    /*  Number of bins actually read by the last call  */
+  int64_t       reserved;                 /*  Memory counted against the budget for this buffer  */
+} BIN_BUFFER;
+
+
+/*  Where the output for one input file went.  Used for shard manifests.  */
+
+typedef struct
+{
+  int32_t       file_number;
+  int32_t       count;
+  int64_t       offset;
+  int64_t       length;
+} SEGMENT;
+
+
+/*  One HOF shot.  Used by the update state for good shots that didn't produce an output line.  */
+
+typedef struct
+{
+  int32_t       file_number;
+  int32_t       record;
+} SHOT;
+
+
+/*  One input file's worth of the read-ahead plan.  */
+
+typedef struct
+{
+  int32_t       file_number;
+  PING_RANGE    *ranges;
+  int32_t       range_count;
+  int64_t       advised;                  /*  Bytes of read-ahead counted against the memory budget  */
+} PREFETCH_ITEM;
+
+
+typedef struct PREFETCH PREFETCH;
+
+
+/*  Cached information about each of the PFM input files.  This is loaded once when the PFM is opened so that we don't  */
+/*  have to call read_list_file or search for the pos/sbet file every time we want to look at an input file.  */
+
+typedef struct
+{
+  char          path[512];
+  int16_t       type;
+  int8_t        pos_state;                /*  0 = not looked up yet, 1 = found, -1 = not found  */
+  char          pos_file[512];
+} FILE_INDEX;
+
+
+typedef struct
+{
+  double          altitude;
+  PFM_OPEN_ARGS   open_args;
+  int32_t         pfm_handle;
+  int32_t         file_count;
+  FILE_INDEX      *file_index;
+  pthread_mutex_t pfm_mutex;              /*  The PFM library is not thread safe  */
+  pthread_mutex_t pos_mutex;              /*  Guards the pos/sbet lookups and the CHARTS POS reader  */
+  int32_t         max_active;             /*  Server mode - maximum number of queries running at once  */
+  int32_t         max_waiting;            /*  Server mode - maximum number of queries waiting to run  */
+  uint8_t         use_index;              /*  Get candidate records from the HOF sidecar indexes instead of the PFM bins  */
+  int32_t         prefetch_depth;         /*  Number of files to read ahead of the extraction (0 = no read-ahead)  */
+  uint8_t         *file_mask;             /*  If not NULL, only extract from files with a non-zero entry (sharding)  */
+  int64_t         max_memory;             /*  Memory budget in bytes (0 = no limit), see memory.c  */
+  int32_t         grid_threads;           /*  Number of files extracted at the same time in grid mode  */
 } OPTIONS;
+
+
+/*  Query area.  One or more rings of vertices (even-odd rule, so inner rings are holes) with a y-slab index for  */
+/*  the point in polygon test (see area.c).  */
+
+typedef struct
+{
+  int32_t       count;
+  int32_t       max_count;
+  double        *x;
+  double        *y;
+  int32_t       ring_count;
+  int32_t       max_rings;
+  int32_t       *ring_start;              /*  First vertex of each ring, ring_start[ring_count] == count  */
+  int32_t       dropped_rings;            /*  Rings thrown away because they had fewer than 3 vertices  */
+  NV_F64_XYMBR  mbr;
+  int32_t       *next;                    /*  Next vertex of each edge  */
+  int32_t       slab_count;
+  double        *slab_y;                  /*  slab_count + 1 slab boundaries  */
+  int32_t       *slab_offset;             /*  slab_count + 1 offsets into slab_edge  */
+  int32_t       *slab_edge;               /*  Edges crossing each slab in left to right order  */
+  int64_t       index_memory;             /*  Memory counted against the budget for the slab index  */
+} AREA;
+
+
+/*  Per bin waveform statistics for grid mode (see grid.c).  Index 0 is the PMT channel and 1 is the APD channel.  */
+
+typedef struct
+{
+  uint64_t      shots;
+  uint64_t      runs[2];                  /*  Qualifying runs  */
+  uint64_t      second[2];                /*  Shots with a second run  */
+  int64_t       rise[2];                  /*  Sum of the rise of the runs  */
+  int64_t       run[2];                   /*  Sum of the length of the runs  */
+} GRID_CELL;
+
+
+typedef struct
+{
+  int32_t       x_start;                  /*  PFM bin column and row of the first cell  */
+  int32_t       y_start;
+  int32_t       width;
+  int32_t       height;
+  GRID_CELL     *cell;
+} GRID;
+
+
+/*  The fields of a HOF record that get_waveforms filters on (see hof_reader.c).  */
+
+typedef struct
+{
+  int64_t       timestamp;
+  double        latitude;
+  double        longitude;
+  float         correct_depth;
+  float         correct_sec_depth;
+  int32_t       abdc;
+  int32_t       sec_abdc;
+} HOF_FIELDS;
+
+
+/*  Block reader for HOF records that only decodes the HOF_FIELDS of each record.  */
+
+typedef struct
+{
+  FILE           *fp;
+  int32_t        mode;                    /*  How the raw records relate to hof_read_record (HOF_RAW_...)  */
+  int32_t        first;                   /*  First record in the block  */
+  int32_t        count;                   /*  Number of records in the block  */
+  uint8_t        *raw;                    /*  The records exactly as they are in the file  */
+  HOF_FIELDS     *fields;                 /*  The projected fields of each record in the block  */
+  int32_t        full_rec;                /*  Record number of the last fully decoded record  */
+  HYDRO_OUTPUT_T full;
+} HOF_READER;
+
+
+/*  HOF timestamp window (microseconds from the epoch, UTC, inclusive).  */
+
+typedef struct
+{
+  int64_t       start;
+  int64_t       end;
+} TIME_WINDOW;
+
+
+/*  Everything needed to extract the waveforms for a single area.  In server mode there may be many of these in use  */
+/*  at one time so nothing in here may be shared between queries.  */
+
+typedef struct
+{
+  AREA          area;
+  LIST_NUM      *list;
+  FILE          *txt_fp;
+  uint8_t       progress;                 /*  Print percent complete to stderr  */
+  int32_t       count;
+  int32_t       total;
+  int32_t       old_percent;
+  int32_t       good_count;
+  int32_t       bad_count;
+  SEGMENT       *segments;                /*  If not NULL, per file output offsets are recorded here  */
+  int32_t       segment_count;
+  PREFETCH      *prefetch;                /*  Read-ahead state (see prefetch.c)  */
+  int64_t       cache_pages;              /*  Pages of HOF/INH data we were about to read ...  */
+  int64_t       cache_resident;           /*  ... and how many of them were already in the page cache  */
+  TIME_WINDOW   *windows;                 /*  If window_count is set, only shots in one of these windows  */
+  int32_t       window_count;
+  GRID          *grid;                    /*  If not NULL, results go into this grid instead of txt_fp  */
+  char          *checkpoint_file;         /*  If not NULL, checkpoints are written here (see checkpoint.c)  */
+  uint64_t      checkpoint_key;           /*  query_digest of the run  */
+  uint8_t       resume;                   /*  Pick up where the checkpoint left off  */
+  uint64_t      checkpoint_digest;        /*  Digest of the output up to checkpoint_offset  */
+  int64_t       checkpoint_offset;
+  int64_t       checkpoint_time;          /*  When the last checkpoint was written  */
+  SHOT          *missed;                  /*  If max_missed is set, good shots that process_waveforms rejected  */
+  int32_t       missed_count;             /*  are added here (see add_missed_shot)  */
+  int32_t       max_missed;
+  int32_t       *shared_bad_count;        /*  If not NULL, bad shots are counted here under shared_mutex instead of  */
+  pthread_mutex_t *shared_mutex;          /*  in bad_count (grid workers, see grid.c)  */
+} QUERY;
+
+
+extern OPTIONS options;
+
+
+uint8_t init_area (AREA *area);
+void free_area (AREA *area);
+uint8_t add_area_point (AREA *area, double lon, double lat);
+uint8_t new_area_ring (AREA *area);
+uint8_t close_area (AREA *area);
+uint8_t read_area (char *path, AREA *area);
+void build_area_index (AREA *area);
+uint8_t inside_area (AREA *area, double x, double y);
+void load_file_index ();
+int32_t load_file_list (char *list_file);
+uint8_t find_pos_file (int32_t file_number, char *pos_file);
+int32_t read_bin_run (int32_t hnd, int32_t row, int32_t column, int32_t width, BIN_BUFFER *buffer);
+void free_bin_buffer (BIN_BUFFER *buffer);
+uint8_t want_file (int32_t file_number);
+uint8_t area_bins (QUERY *query, int32_t *x_start, int32_t *y_start, int32_t *width, int32_t *height);
+int32_t scan_area (QUERY *query, uint32_t *digest);
+int32_t extract_plan (QUERY *query, PREFETCH_ITEM *plan, int32_t plan_count);
+int32_t extract_area (QUERY *query);
+int32_t extract_area_indexed (QUERY *query);
+uint8_t build_hof_index (char *path, uint8_t force);
+int32_t hof_index_ranges (char *path, NV_F64_XYMBR *mbr, PING_RANGE **ranges);
+uint8_t add_time_window (QUERY *query, char *string);
+int32_t apply_time_windows (QUERY *query, int32_t file_number, PING_RANGE **ranges, int32_t *range_count);
+uint8_t open_hof_reader (HOF_READER *reader, FILE *fp);
+void close_hof_reader (HOF_READER *reader);
+FILE *charts_open_hof (char *path);
+uint8_t charts_read_hof (FILE *fp, int32_t rec, HYDRO_OUTPUT_T *hof);
+FILE *charts_open_wave (char *path, WAVE_HEADER_T *header);
+uint8_t charts_read_wave (FILE *fp, int32_t rec, WAVE_DATA_T *data);
+void charts_close (FILE *fp);
+HOF_FIELDS *hof_read_fields (HOF_READER *reader, int32_t rec, int32_t end);
+void hof_read_full (HOF_READER *reader, int32_t rec, HYDRO_OUTPUT_T *hof);
+int32_t get_waveforms (int32_t file_number, PING_RANGE *ranges, int32_t range_count, QUERY *query);
+uint8_t process_waveforms (HYDRO_OUTPUT_T *hof, WAVE_HEADER_T *wave_header, WAVE_DATA_T *wave_data, WAVE_RESULT *result);
+void write_waveform_result (FILE *txt_fp, HYDRO_OUTPUT_T *hof, int32_t file_number, int32_t rec, WAVE_RESULT *result);
+void start_prefetch (QUERY *query, PREFETCH_ITEM *plan, int32_t count);
+void prefetch_advance (QUERY *query, PREFETCH_ITEM *plan, int32_t index);
+void prefetch_done (QUERY *query, PREFETCH_ITEM *plan, int32_t index, int32_t count);
+void stop_prefetch (QUERY *query);
+uint8_t parse_memory_size (char *string, int64_t *bytes);
+uint8_t reserve_memory (int64_t bytes, uint8_t force);
+void release_memory (int64_t bytes);
+void report_memory ();
+uint64_t fnv (uint64_t hash, const void *data, size_t length);
+uint64_t query_digest (QUERY *query, char *pfm_file, uint8_t selection);
+uint8_t add_missed_shot (QUERY *query, int32_t file_number, int32_t record);
+int32_t update_area (QUERY *query, char *pfm_file, char *txt_file, char *state_file);
+int32_t resume_checkpoint (QUERY *query, PREFETCH_ITEM *plan, int32_t plan_count, int32_t *icount);
+uint8_t write_checkpoint (QUERY *query, PREFETCH_ITEM *plan, int32_t plan_count, int32_t done, int32_t icount);
+int32_t run_server (char *socket_path);
+uint8_t init_grid (QUERY *query, GRID *grid);
+void free_grid (GRID *grid);
+void add_grid_result (GRID *grid, HYDRO_OUTPUT_T *hof, WAVE_RESULT *result);
+int32_t grid_plan (QUERY *query, PREFETCH_ITEM *plan, int32_t plan_count);
+uint8_t write_grid (char *grid_file, GRID *grid);
+uint8_t parse_shard (char *string, int32_t *shard, int32_t *shard_count);
+uint8_t parse_file_numbers (char *string);
+void shard_file_names (char *areafile, int32_t shard, int32_t shard_count, char *txt_file, char *manifest_file);
+uint8_t write_manifest (char *manifest_file, int32_t shard, int32_t shard_count, QUERY *query, int32_t icount, uint64_t key);
+int32_t merge_shards (char *areafile, int32_t shard_count);
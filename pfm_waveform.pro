@@ -1,5 +1,5 @@
 INCLUDEPATH += /c/PFM_ABEv7.0.0_Win64/include
-LIBS += -L /c/PFM_ABEv7.0.0_Win64/lib -lCHARTS -lnvutility -lpfm -lgdal -lxml2 -lpoppler -lz -liconv -lstdc++ -lm
+LIBS += -L /c/PFM_ABEv7.0.0_Win64/lib -lCHARTS -lnvutility -lpfm -lgdal -lxml2 -lpoppler -lz -liconv -lstdc++ -lpthread -lm
 DEFINES += NVWIN3X
 CONFIG += console
 CONFIG -= qt
@@ -15,4 +15,4 @@ INCLUDEPATH += .
 
 # Input
 HEADERS += pfm_waveform.h version.h
-SOURCES += main.c process_waveforms.c
+SOURCES += area.c bin_row.c charts_io.c checkpoint.c digest.c extract_area.c file_index.c get_waveforms.c grid.c hof_index.c hof_reader.c main.c memory.c prefetch.c process_waveforms.c server.c shard.c time_window.c update.c
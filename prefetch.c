@@ -0,0 +1,369 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+
+/*  Once the bin scan (or the sidecar index lookup) is done we know every file and record range that get_waveforms is  */
+/*  going to read, in order.  The prefetch thread walks that plan up to "depth" files ahead of the extraction and tells  */
+/*  the kernel to start reading the HOF record ranges, the matching part of the INH file, and the pos/sbet file into  */
+/*  the page cache.  Right before each file is extracted we check how much of its HOF and INH ranges are already in the  */
+/*  page cache so we can report a hit rate.  The INH records are compressed so we don't know exactly where a record  */
+/*  range is.  We use the same fraction of the file as the records are of the HOF file, plus a little slop.  */
+
+#ifndef NVWIN3X
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+struct PREFETCH
+{
+  pthread_t       thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+  PREFETCH_ITEM   *plan;
+  int32_t         count;
+  int32_t         depth;
+  int32_t         consumer;
+  uint8_t         stop;
+};
+
+
+#define PREFETCH_ADVISE    0
+#define PREFETCH_MEASURE   1
+#define PREFETCH_EVICT     2
+#define PREFETCH_SIZE      3
+
+
+/*  Advise, measure, or evict one byte range of a file (PREFETCH_SIZE does nothing).  */
+
+static void file_range (char *path, int64_t offset, int64_t length, int32_t mode, int64_t *pages, int64_t *resident)
+{
+  int32_t        fd, page_size;
+  int64_t        i, start, npages;
+  void           *map;
+  unsigned char  *vec;
+
+
+  if (mode == PREFETCH_SIZE || !length || (fd = open (path, O_RDONLY)) < 0) return;
+
+
+  /*  A negative length means "to the end of the file" (only used for advice and eviction).  */
+
+  if (mode != PREFETCH_MEASURE)
+    {
+      posix_fadvise (fd, offset, length < 0 ? 0 : length, mode == PREFETCH_ADVISE ? POSIX_FADV_WILLNEED : POSIX_FADV_DONTNEED);
+      close (fd);
+      return;
+    }
+
+  page_size = sysconf (_SC_PAGESIZE);
+  start = (offset / page_size) * page_size;
+  length += offset - start;
+  npages = (length + page_size - 1) / page_size;
+
+  map = mmap (NULL, length, PROT_READ, MAP_SHARED, fd, start);
+  close (fd);
+
+  if (map == MAP_FAILED) return;
+
+  if ((vec = (unsigned char *) malloc (npages)) != NULL)
+    {
+      if (!mincore (map, length, vec))
+        {
+          *pages += npages;
+          for (i = 0 ; i < npages ; i++) *resident += (vec[i] & 1);
+        }
+      free (vec);
+    }
+
+  munmap (map, length);
+}
+
+
+
+/*  Advise, measure, or evict all of the byte ranges that get_waveforms will read for one plan item.  Returns the  */
+/*  number of HOF and INH bytes involved.  The pos/sbet file is only advised or evicted, and only if pos is set.  */
+
+static int64_t plan_item (PREFETCH_ITEM *item, int32_t mode, uint8_t pos, int64_t *pages, int64_t *resident)
+{
+  FILE_INDEX     *entry;
+  struct stat    hof_stat, inh_stat;
+  char           wave_file[512], pos_file[512];
+  int32_t        i, records;
+  int64_t        rec_size, slop, start, end, bytes = 0;
+
+
+  entry = &options.file_index[item->file_number];
+
+  if (!item->range_count || stat (entry->path, &hof_stat)) return (0);
+
+  rec_size = sizeof (HYDRO_OUTPUT_T);
+  records = (hof_stat.st_size - HOF_HEAD_SIZE) / rec_size;
+  if (records < 1) return (0);
+
+
+  /*  HOF ranges are exact.  */
+
+  for (i = 0 ; i < item->range_count ; i++)
+    {
+      file_range (entry->path, HOF_HEAD_SIZE + (int64_t) (item->ranges[i].start - 1) * rec_size,
+                  (int64_t) (item->ranges[i].end - item->ranges[i].start + 1) * rec_size, mode, pages, resident);
+      bytes += (int64_t) (item->ranges[i].end - item->ranges[i].start + 1) * rec_size;
+    }
+
+
+  /*  INH is proportional.  */
+
+  strcpy (wave_file, entry->path);
+  strcpy (&wave_file[strlen (wave_file) - 4], ".inh");
+
+  if (!stat (wave_file, &inh_stat))
+    {
+      slop = inh_stat.st_size / 20;
+      start = (int64_t) inh_stat.st_size * (item->ranges[0].start - 1) / records - slop;
+      end = (int64_t) inh_stat.st_size * item->ranges[item->range_count - 1].end / records + slop;
+      if (start < 0) start = 0;
+      if (end > inh_stat.st_size) end = inh_stat.st_size;
+
+      file_range (wave_file, start, end - start, mode, pages, resident);
+      bytes += end - start;
+    }
+
+
+  /*  The pos/sbet file is read by binary search so we just ask for all of it.  */
+
+  if (pos && (mode == PREFETCH_ADVISE || mode == PREFETCH_EVICT) && find_pos_file (item->file_number, pos_file)) file_range (pos_file, 0, -1, mode, NULL, NULL);
+
+  return (bytes);
+}
+
+
+
+/*  Stays at most depth files ahead of the extraction and skips read-ahead that doesn't fit in the memory budget.  */
+
+static void *prefetch_thread (void *arg)
+{
+  PREFETCH       *prefetch = (PREFETCH *) arg;
+  PREFETCH_ITEM  *item;
+  int64_t        bytes;
+  int32_t        i;
+  uint8_t        stop, skip;
+
+
+  for (i = 0 ; i < prefetch->count ; i++)
+    {
+      item = &prefetch->plan[i];
+
+      pthread_mutex_lock (&prefetch->mutex);
+      while (!prefetch->stop && i > prefetch->consumer + prefetch->depth) pthread_cond_wait (&prefetch->cond, &prefetch->mutex);
+
+      stop = prefetch->stop;
+
+
+      /*  Don't bother with files the extraction has already finished.  */
+
+      skip = (i < prefetch->consumer);
+
+      if (options.max_memory && !stop && !skip)
+        {
+          bytes = plan_item (item, PREFETCH_SIZE, NVFalse, NULL, NULL);
+
+          if (reserve_memory (bytes, NVFalse))
+            {
+              item->advised = bytes;
+            }
+          else
+            {
+              skip = NVTrue;
+            }
+        }
+      pthread_mutex_unlock (&prefetch->mutex);
+
+      if (stop) break;
+      if (skip) continue;
+
+      plan_item (item, PREFETCH_ADVISE, NVTrue, NULL, NULL);
+    }
+
+  return (NULL);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        start_prefetch                                      *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Start the read-ahead thread for an extraction plan. *
+*                       The plan must stay valid until stop_prefetch.       *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                       plan           - files and record ranges in the     *
+*                                        order they will be extracted       *
+*                       count          - number of plan items               *
+*                                                                           *
+\***************************************************************************/
+
+void start_prefetch (QUERY *query, PREFETCH_ITEM *plan, int32_t count)
+{
+  PREFETCH       *prefetch;
+  int32_t        i;
+
+
+  query->prefetch = NULL;
+
+  for (i = 0 ; i < count ; i++) plan[i].advised = 0;
+
+  if (options.prefetch_depth <= 0 || !count) return;
+
+  if ((prefetch = (PREFETCH *) calloc (1, sizeof (PREFETCH))) == NULL) return;
+
+  pthread_mutex_init (&prefetch->mutex, NULL);
+  pthread_cond_init (&prefetch->cond, NULL);
+  prefetch->plan = plan;
+  prefetch->count = count;
+  prefetch->depth = options.prefetch_depth;
+  prefetch->consumer = 0;
+
+  if (pthread_create (&prefetch->thread, NULL, prefetch_thread, prefetch))
+    {
+      free (prefetch);
+      return;
+    }
+
+  query->prefetch = prefetch;
+}
+
+
+
+/*  Called right before plan item "index" is extracted.  Measures how much of it is in the page cache and lets the  */
+/*  prefetch thread move ahead.  */
+
+void prefetch_advance (QUERY *query, PREFETCH_ITEM *plan, int32_t index)
+{
+  PREFETCH       *prefetch = query->prefetch;
+
+
+  plan_item (&plan[index], PREFETCH_MEASURE, NVFalse, &query->cache_pages, &query->cache_resident);
+
+  if (prefetch == NULL) return;
+
+  pthread_mutex_lock (&prefetch->mutex);
+  prefetch->consumer = index;
+  pthread_cond_signal (&prefetch->cond);
+  pthread_mutex_unlock (&prefetch->mutex);
+}
+
+
+
+/*  Called after plan item "index" has been extracted.  With a memory budget we don't need its HOF and INH pages any  */
+/*  more so we drop them from the page cache (and the pos/sbet file too if the next file doesn't use it).  */
+
+void prefetch_done (QUERY *query, PREFETCH_ITEM *plan, int32_t index, int32_t count)
+{
+  PREFETCH       *prefetch = query->prefetch;
+  char           pos_file[512], next_pos_file[512];
+  uint8_t        pos;
+  int64_t        advised;
+
+
+  if (!options.max_memory) return;
+
+  pos = find_pos_file (plan[index].file_number, pos_file);
+  if (pos && index + 1 < count && find_pos_file (plan[index + 1].file_number, next_pos_file) && !strcmp (pos_file, next_pos_file))
+    pos = NVFalse;
+
+  plan_item (&plan[index], PREFETCH_EVICT, pos, NULL, NULL);
+
+  if (prefetch != NULL) pthread_mutex_lock (&prefetch->mutex);
+  advised = plan[index].advised;
+  plan[index].advised = 0;
+  if (prefetch != NULL) pthread_mutex_unlock (&prefetch->mutex);
+
+  release_memory (advised);
+}
+
+
+
+void stop_prefetch (QUERY *query)
+{
+  PREFETCH       *prefetch = query->prefetch;
+  int32_t        i;
+
+
+  if (prefetch == NULL) return;
+
+  pthread_mutex_lock (&prefetch->mutex);
+  prefetch->stop = NVTrue;
+  pthread_cond_signal (&prefetch->cond);
+  pthread_mutex_unlock (&prefetch->mutex);
+
+  pthread_join (prefetch->thread, NULL);
+
+
+  /*  Anything read ahead that we never got to.  */
+
+  for (i = 0 ; i < prefetch->count ; i++)
+    {
+      release_memory (prefetch->plan[i].advised);
+      prefetch->plan[i].advised = 0;
+    }
+
+  pthread_mutex_destroy (&prefetch->mutex);
+  pthread_cond_destroy (&prefetch->cond);
+  free (prefetch);
+
+  query->prefetch = NULL;
+}
+
+#else
+
+void start_prefetch (QUERY *query, PREFETCH_ITEM *plan, int32_t count)
+{
+  int32_t        i;
+
+  for (i = 0 ; i < count ; i++) plan[i].advised = 0;
+
+  query->prefetch = NULL;
+}
+
+void prefetch_advance (QUERY *query __attribute__ ((unused)), PREFETCH_ITEM *plan __attribute__ ((unused)),
+                       int32_t index __attribute__ ((unused)))
+{
+}
+
+void prefetch_done (QUERY *query __attribute__ ((unused)), PREFETCH_ITEM *plan __attribute__ ((unused)),
+                    int32_t index __attribute__ ((unused)), int32_t count __attribute__ ((unused)))
+{
+}
+
+void stop_prefetch (QUERY *query __attribute__ ((unused)))
+{
+}
+
+#endif
@@ -23,402 +23,319 @@
 
 #include "pfm_waveform.h"
 
-#define DEBUG
 
-/***************************************************************************\
-*                                                                           *
-*   Module Name:        process_waveforms                                   *
-*                                                                           *
-*   Programmer(s):      Jan C. Depner                                       *
-*                                                                           *
-*   Date Written:       November 2010                                       *
-*                                                                           *
-*   Purpose:            Process the APD and PMT waveforms to try to detect  *
-*                       small objects near the selected return(s).          *
-*                                                                           *
-*   Arguments:          hof_record     - the HOF record                     *
-*                       wave_header    - wave file header                   *
-*                       wave_data      - the wave file header               *
-*                                                                           *
-\***************************************************************************/
+/*  Per channel settings.  A channel is finished when more than "limit" samples are less than "threshold" above the  */
+/*  channel's ac zero offset.  The PMT and APD values are what we've always used, IR and Raman use the APD values.  */
 
-uint8_t process_waveforms (HYDRO_OUTPUT_T *hof, WAVE_HEADER_T *wave_header, WAVE_DATA_T *wave_data, FILE *txt_fp __attribute__ ((unused)),
-                           int32_t rec __attribute__ ((unused)))
+static const struct
 {
-  int32_t        i, j, k, rise, start_run, drop = 0, p_start_data[2], p_end_data[2], p_data_rise[2], p_data_run[2], p_count, first_drop,
-                 threshold_count, a_start_data[2], a_end_data[2], a_data_rise[2], a_data_run[2], a_count, run_req, start_loc, end_loc;
-
-
-  /*  Don't mess with shoreline depth swapped or shallow water algorithm data.  */
-
-  if (hof->abdc == 72 || hof->sec_abdc == 72 || hof->abdc == 74 || hof->sec_abdc == 74) return (NVFalse);
-
+  int32_t       threshold;
+  int32_t       limit;
+} channel_limits[WAVE_CHANNELS] = {{15, 10}, {0, 20}, {0, 20}, {0, 20}};
 
-  /*  Hard wired to 6 for the moment.  */
 
-  run_req = 6;
+/*  Running first and second difference features for a run.  */
 
+typedef struct
+{
+  int32_t       n;
+  float         max_slope;
+  float         max_curvature;
+  int32_t       inflections;
+  float         prev_diff;
+  float         prev_second;
+} RUN_FEATURES;
 
-  /*  Initialize the run and slope variables for the PMT data.  */
 
-  rise = 0;
-  drop = 0;
-  start_run = 0;
-  threshold_count = 0;
-  start_loc = 0;
-  end_loc = 0;
-  p_start_data[0] = p_start_data[1] = 0;
-  p_end_data[0] = p_end_data[1] = 0;
-  p_data_rise[0] = p_data_rise[1] = 0;
-  p_data_run[0] = p_data_run[1] = 0;
-  p_count = 0;
+/*  Run detection state for one channel.  */
 
+typedef struct
+{
+  int32_t       rise;
+  int32_t       drop;
+  int32_t       start_run;
+  int32_t       threshold_count;
+  int32_t       start_loc;
+  int32_t       end_loc;
+  int32_t       first_drop;
+  uint8_t       done;
+  RUN_FEATURES  live;                     /*  Features from start_loc + 1 up to the current sample  */
+  RUN_FEATURES  at_end;                   /*  Features from start_run + 1 up to end_loc  */
+} CHANNEL_STATE;
 
-  /*  Initialize the first_drop index.  We don't want to start searching for runs until we've cleared the surface  */
-  /*  return.  This is not how Optech does it but I'm not really interested in very shallow water for this.  */
 
-  first_drop = 0;
 
+static void add_diff (RUN_FEATURES *features, float diff)
+{
+  float          second;
 
-  /*  Loop through the PMT data looking for runs of increasing value that exceed "run_req".  Skip the first 20  */
-  /*  bins so that we don't start looking in the noisy section prior to the surface return.  */
 
-  for (i = 20 ; i < wave_header->pmt_size ; i++)
+  if (features->n)
     {
-      /*  If we get 10 points within 15 of the ac zero offset we're done.  */
-
-      if (wave_data->pmt[i] - wave_header->ac_zero_offset[PMT] < 15)
-        {
-          threshold_count++;
-          if (threshold_count > 10) break;
-        }
-
-
-      /*  If the value is increasing...   */
-
-      if (first_drop && (wave_data->pmt[i] - wave_data->pmt[i - 1] > 0))
-        {
-          if (!start_loc) start_loc = i;
+      second = diff - features->prev_diff;
 
+      if (fabsf (second) > features->max_curvature) features->max_curvature = fabsf (second);
 
-          /*  Increment the rise count.  */
+      if (features->n > 1 && ((second > 0.0 && features->prev_second < 0.0) || (second < 0.0 && features->prev_second > 0.0)))
+        features->inflections++;
 
-          rise++;
+      features->prev_second = second;
+    }
 
+  if (!features->n || diff > features->max_slope) features->max_slope = diff;
 
-          /*  If we have not already started a run and the rise count is greater than "run_req", start a new run.  */
+  features->prev_diff = diff;
+  features->n++;
+}
 
-          if (!start_run && rise > run_req) start_run = start_loc;
 
 
-          /*  Set the drop count to 0.  */
+/*  Process sample i of one channel.  This is the same run detection that used to be done separately for the PMT and  */
+/*  APD arrays, with the derivative features of the run built up as we go instead of in a second pass over the run.  */
 
-          drop = 0;
-        }
+static void channel_step (CHANNEL_STATE *state, WAVE_RUNS *runs, uint16_t *data, int32_t i, int32_t ac_zero, int32_t channel)
+{
+  int32_t        diff = data[i] - data[i - 1];
 
 
-      /*  If the value is decreasing  */
+  /*  If we get enough points close to the ac zero offset we're done.  */
 
-      else if (wave_data->pmt[i] - wave_data->pmt[i - 1] <= 0)
+  if (data[i] - ac_zero < channel_limits[channel].threshold)
+    {
+      state->threshold_count++;
+      if (state->threshold_count > channel_limits[channel].limit)
         {
-          if (!drop) end_loc = i;
-
-
-          /*  Increment the drop counter.  */
-
-          drop++;
-
-
-          /*  If we have five consecutive drops...  */
-
-          if (drop >= 5)
-            {
-              if (!first_drop)
-                {
-                  first_drop = i;
-                }
-              else
-                {
-                  /*  If we have a run going of more than "run_req" points (qualifying run) ...  */
-
-                  if (start_run)
-                    {
-#ifdef DEBUG
-                      fprintf(stderr,"%s %s %d %d %d\n",__FILE__,__FUNCTION__,__LINE__,start_run,i);
-#endif
-                      /*  Save the start, end, run, and rise values for this run.  */
-
-                      p_start_data[p_count] = start_run;
-                      p_end_data[p_count] = end_loc;
-                      p_data_run[p_count] = end_loc - start_loc + 1;
-                      p_data_rise[p_count] = wave_data->pmt[end_loc] - wave_data->pmt[start_run];
+          state->done = NVTrue;
+          return;
+        }
+    }
 
 
-                      /*  Increment the qualifying run counter.  */
+  /*  If we've got a candidate or a qualifying run going, this sample's first difference belongs to it.  */
 
-                      p_count++;
+  if (state->start_run || state->start_loc) add_diff (&state->live, (float) diff);
 
 
-                      /*  If we have encountered 2 qualifying runs we can stop looking at the data.  */
+  /*  If the value is increasing...  */
 
-                      if (p_count == 2) break;
-                    }
+  if (state->first_drop && diff > 0)
+    {
+      if (!state->start_loc)
+        {
+          state->start_loc = i;
 
 
-                  /*  Zero out the rise count and start_run to get ready for the next qualifying run.  */
+          /*  A new candidate run starts here (the difference at start_loc isn't part of the run).  */
 
-                  rise = 0;
-                  start_run = 0;
-                }
-            }
-          start_loc = 0;
+          if (!state->start_run) memset (&state->live, 0, sizeof (RUN_FEATURES));
         }
-    }
-
 
-  /*  If we incremented to p_count == 2 but never got another start_run we need to decrement p_count.  */
 
-  if (p_count == 2 && !start_run) p_count--;
+      /*  Increment the rise count.  */
 
+      state->rise++;
 
 
-  /*  Hard wired to 6 for the moment.  */
+      /*  If we have not already started a run and the rise count is greater than "run_req", start a new run.  */
 
-  run_req = 6;
+      if (!state->start_run && state->rise > WAVE_RUN_REQ) state->start_run = state->start_loc;
 
 
-  /*  Initialize the run and slope variables for the APD data.  */
+      /*  Set the drop count to 0.  */
 
-  rise = 0;
-  drop = 0;
-  start_run = 0;
-  threshold_count = 0;
-  start_loc = 0;
-  end_loc = 0;
-  a_start_data[0] = a_start_data[1] = 0;
-  a_end_data[0] = a_end_data[1] = 0;
-  a_data_rise[0] = a_data_rise[1] = 0;
-  a_data_run[0] = a_data_run[1] = 0;
-  a_count = 0;
-
-
-  /*  Initialize the first_drop index.  We don't want to start searching for runs until we've cleared the surface  */
-  /*  return.  This is not how Optech does it but I'm not really interested in very shallow water for this.  */
-
-  first_drop = 0;
+      state->drop = 0;
+    }
 
 
-  /*  Loop through the APD data looking for runs of increasing value that exceed "run_req".  Skip the first 20  */
-  /*  bins so that we don't start looking in the noisy section prior to the surface return.  */
+  /*  If the value is decreasing  */
 
-  for (i = 20 ; i < wave_header->apd_size ; i++)
+  else if (diff <= 0)
     {
-      /*  If we get 20 points under the ac zero offset we're done.  */
-
-      if (wave_data->apd[i] - wave_header->ac_zero_offset[APD] < 0)
+      if (!state->drop)
         {
-          threshold_count++;
-          if (threshold_count > 20) break;
+          state->end_loc = i;
+          state->at_end = state->live;
         }
 
 
-      /*  If the value is increasing...  */
-
-      if (first_drop && (wave_data->apd[i] - wave_data->apd[i - 1] > 0))
-        {
-          if (!start_loc) start_loc = i;
-
-
-          /*  Increment the rise count.  */
+      /*  Increment the drop counter.  */
 
-          rise++;
+      state->drop++;
 
 
-          /*  If we have not already started a run and the rise count is greater than "run_req", start a new run.  */
-
-          if (!start_run && rise > run_req) start_run = start_loc;
+      /*  If we have five consecutive drops...  */
 
+      if (state->drop >= 5)
+        {
+          if (!state->first_drop)
+            {
+              state->first_drop = i;
+            }
+          else
+            {
+              /*  If we have a run going of more than "run_req" points (qualifying run) ...  */
 
-          /*  Set the drop count to 0.  */
+              if (state->start_run)
+                {
+                  /*  Save the start, end, run, rise, and derivative values for this run.  */
 
-          drop = 0;
-        }
+                  runs->start[runs->count] = state->start_run;
+                  runs->end[runs->count] = state->end_loc;
+                  runs->run[runs->count] = state->end_loc - state->start_loc + 1;
+                  runs->rise[runs->count] = data[state->end_loc] - data[state->start_run];
+                  runs->max_slope[runs->count] = state->at_end.max_slope;
+                  runs->max_curvature[runs->count] = state->at_end.max_curvature;
+                  runs->inflections[runs->count] = state->at_end.inflections;
 
 
-      /*  If the value is decreasing  */
+                  /*  Increment the qualifying run counter.  */
 
-      else if (wave_data->apd[i] - wave_data->apd[i - 1] <= 0)
-        {
-          if (!drop) end_loc = i;
+                  runs->count++;
 
 
-          /*  Increment the drop counter.  */
+                  /*  If we have encountered 2 qualifying runs we can stop looking at the data.  */
 
-          drop++;
+                  if (runs->count == 2)
+                    {
+                      state->done = NVTrue;
+                      return;
+                    }
+                }
 
 
-          /*  If we have five consecutive drops...  */
+              /*  Zero out the rise count and start_run to get ready for the next qualifying run.  */
 
-          if (drop >= 5)
-            {
-              if (!first_drop)
-                {
-                  first_drop = i;
-                }
-              else
-                {
-                  /*  If we have a run going of more than "run_req" points (qualifying run) ...  */
+              state->rise = 0;
+              state->start_run = 0;
+            }
+        }
+      state->start_loc = 0;
+    }
+}
 
-                  if (start_run)
-                    {
-                      /*  Save the start, end, run, and rise values for this run.  */
 
-                      a_start_data[a_count] = start_run;
-                      a_end_data[a_count] = end_loc;
-                      a_data_run[a_count] = end_loc - start_loc + 1;
-                      a_data_rise[a_count] = wave_data->apd[end_loc] - wave_data->apd[start_run];
 
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        process_waveforms                                   *
+*                                                                           *
+*   Programmer(s):      Jan C. Depner                                       *
+*                                                                           *
+*   Date Written:       November 2010                                       *
+*                                                                           *
+*   Purpose:            Process the PMT, APD, IR, and Raman waveforms to    *
+*                       try to detect small objects near the selected       *
+*                       return(s).  All four channels are scanned together  *
+*                       in one pass over the sample index and the first and *
+*                       second difference features of each qualifying run   *
+*                       are computed in the same pass.                      *
+*                                                                           *
+*   Arguments:          hof_record     - the HOF record                     *
+*                       wave_header    - wave file header                   *
+*                       wave_data      - the wave file record               *
+*                       result         - returned per channel runs          *
+*                                                                           *
+*   Returns:            NVFalse if the shot was skipped                     *
+*                                                                           *
+\***************************************************************************/
 
-                      /*  Increment the qualifying rise counter.  */
+uint8_t process_waveforms (HYDRO_OUTPUT_T *hof, WAVE_HEADER_T *wave_header, WAVE_DATA_T *wave_data, WAVE_RESULT *result)
+{
+  CHANNEL_STATE  state[WAVE_CHANNELS];
+  uint16_t       *data[WAVE_CHANNELS];
+  int32_t        i, c, size[WAVE_CHANNELS], max_size, active;
 
-                      a_count++;
 
+  memset (result, 0, sizeof (WAVE_RESULT));
 
-                      /*  If we have encountered 2 qualifying runs we can stop looking at the data.  */
 
-                      if (a_count == 2) break;
-                    }
+  /*  Don't mess with shoreline depth swapped or shallow water algorithm data.  */
 
+  if (hof->abdc == 72 || hof->sec_abdc == 72 || hof->abdc == 74 || hof->sec_abdc == 74) return (NVFalse);
 
-                  /*  Zero out the rise count and start_run to get ready for the next qualifying run.  */
 
-                  rise = 0;
-                  start_run = 0;
-                }
-            }
-          start_loc = 0;
-        }
-    }
+  data[PMT] = wave_data->pmt;
+  data[APD] = wave_data->apd;
+  data[IR] = wave_data->ir;
+  data[RAMAN] = wave_data->raman;
+  size[PMT] = wave_header->pmt_size;
+  size[APD] = wave_header->apd_size;
+  size[IR] = wave_header->ir_size;
+  size[RAMAN] = wave_header->raman_size;
 
+  memset (state, 0, sizeof (state));
 
-  /*  If we incremented to a_count == 2 but never got another start_run we need to decrement a_count.  */
+  max_size = 0;
+  for (c = 0 ; c < WAVE_CHANNELS ; c++) if (size[c] > max_size) max_size = size[c];
 
-  if (a_count == 2 && !start_run) a_count--;
 
+  /*  Skip the first 20 bins so that we don't start looking in the noisy section prior to the surface return.  We  */
+  /*  don't start looking for runs in a channel until we've cleared the surface return (first_drop).  This is not how  */
+  /*  Optech does it but I'm not really interested in very shallow water for this.  */
 
-#ifdef DEBUG
-  fprintf(stderr,"%s %s %d %d %d %d\n",__FILE__,__FUNCTION__,__LINE__,p_count,a_count,hof->bot_bin_used_pmt);
-#endif
-  /*  Loop through the qualifying PMT runs.  */
-  /*
-  uint8_t        tagged;
-  tagged = NVFalse;
-  for (j = 0 ; j < p_count ; j++)
+  for (i = 20 ; i < max_size ; i++)
     {
-      prev_slope = 0.0;
-#ifdef DEBUG
-      fprintf(stderr,"%s %s %d %d %d\n",__FILE__,__FUNCTION__,__LINE__,p_data_rise[j],p_data_run[j]);
-#endif
-      for (i = p_start_data[j] + 1 ; i <= p_end_data[j] ; i++)
-        {
-          if ((i - (p_start_data[j] + 1)) >= 3)
-            {
-              slope = (wave_data->pmt[i] - wave_data->pmt[i - 3]) / 3.0;
+      active = 0;
 
-#ifdef DEBUG
-              fprintf (stderr,"%s %s %d %d %d %d %d %f\n",__FILE__,__FUNCTION__,__LINE__,j,i,wave_data->pmt[i - 1], wave_data->pmt[i], slope);
-#endif
-
-              if (!tagged && (p_end_data[j] - i) > 10 && (i - p_start_data[j]) > 5 && (prev_slope - slope) > 2.1)
-                {
-                  fprintf (txt_fp, "%.11f,%.11f,%f\n", hof->latitude, hof->longitude, 10000000.0 + (float) rec);
-                  tagged = NVTrue;
-                }
+      for (c = 0 ; c < WAVE_CHANNELS ; c++)
+        {
+          if (state[c].done || i >= size[c]) continue;
 
-              prev_slope = slope;  
-            }
+          channel_step (&state[c], &result->channel[c], data[c], i, wave_header->ac_zero_offset[c], c);
+          active++;
         }
-    }
-
 
-  for (j = 0 ; j < a_count ; j++)
-    {
-      prev_slope = 0.0;
-#ifdef DEBUG
-      fprintf(stderr,"%s %s %d %d %d\n",__FILE__,__FUNCTION__,__LINE__,a_data_rise[j],a_data_run[j]);
-#endif
-      for (i = a_start_data[j] + 1 ; i <= a_end_data[j] ; i++)
-        {
-          if ((i - (a_start_data[j] + 1)) >= 3)
-            {
-              slope = (wave_data->apd[i] - wave_data->apd[i - 3]) / 3.0;
+      if (!active) break;
+    }
 
-#ifdef DEBUG
-              fprintf (stderr,"%s %s %d %d %d %d %d %f\n",__FILE__,__FUNCTION__,__LINE__,j,i,wave_data->apd[i - 1], wave_data->apd[i], slope);
-#endif
 
-              if (!tagged && (a_end_data[j] - i) > 10 && (i - a_start_data[j]) > 5 && (prev_slope - slope) > 2.1)
-                {
-                  fprintf (txt_fp, "%.11f,%.11f,%f\n", hof->latitude, hof->longitude, 20000000.0 + (float) rec);
-                  tagged = NVTrue;
-                }
+  /*  If we incremented to count == 2 but never got another start_run we need to decrement count.  */
 
-              prev_slope = slope;
-            }
-        }
+  for (c = 0 ; c < WAVE_CHANNELS ; c++)
+    {
+      if (result->channel[c].count == 2 && !state[c].start_run) result->channel[c].count--;
     }
 
-  tagged = NVFalse;
+  return (NVTrue);
+}
 
-  */
 
-  for (j = 0 ; j < p_count ; j++)
-    {
-      float *first_diff, *second_diff;
-      int32_t size_first = p_end_data[j] - p_start_data[j];
-      int32_t size_second = p_end_data[j] - p_start_data[j] - 1;
-      first_diff = (float *) calloc (size_first, sizeof (float));
-      second_diff = (float *) calloc (size_second, sizeof (float));
 
-      for (i = p_start_data[j] + 1, k = 0 ; i <= p_end_data[j] ; i++, k++)
-        {
-          first_diff[k] = wave_data->pmt[i] - wave_data->pmt[i - 1];
-          fprintf(stderr, "%s %s %d %d %d %d %f\n",__FILE__,__FUNCTION__,__LINE__,k,wave_data->pmt[i - 1],wave_data->pmt[i],first_diff[k]);
-        }
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        write_waveform_result                               *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Write one shot's results to the .pts output.  The   *
+*                       line is latitude, longitude, PFM file number, HOF   *
+*                       record number, and then for each of the PMT, APD,   *
+*                       IR, and Raman channels the number of qualifying     *
+*                       runs followed by the start, rise, run, max slope,   *
+*                       max curvature, and inflections of the two possible  *
+*                       runs (56 columns in all).  If this changes, change  *
+*                       the usage text and line_key in update.c too.        *
+*                                                                           *
+\***************************************************************************/
 
-      for (i = 1, k = 0 ; i < size_first ; i++, k++)
-        {
-          second_diff[k] = first_diff[i] - first_diff[i - 1];
-          fprintf(stderr, "%s %s %d %d %f\n",__FILE__,__FUNCTION__,__LINE__,k,second_diff[k]);
-        }
+void write_waveform_result (FILE *txt_fp, HYDRO_OUTPUT_T *hof, int32_t file_number, int32_t rec, WAVE_RESULT *result)
+{
+  int32_t        c, j;
+  WAVE_RUNS      *runs;
 
-      free (first_diff);
-      free (second_diff);
-    }
 
-  for (j = 0 ; j < a_count ; j++)
-    {
-      float *first_diff, *second_diff;
-      int32_t size_first = a_end_data[j] - a_start_data[j];
-      int32_t size_second = a_end_data[j] - a_start_data[j] - 1;
-      first_diff = (float *) calloc (size_first, sizeof (float));
-      second_diff = (float *) calloc (size_second, sizeof (float));
+  fprintf (txt_fp, "%.11f,%.11f,%d,%d", hof->latitude, hof->longitude, file_number, rec);
 
-      for (i = a_start_data[j] + 1, k = 0 ; i <= a_end_data[j] ; i++, k++)
-        {
-          first_diff[k] = wave_data->apd[i] - wave_data->apd[i - 1];
-          fprintf(stderr, "%s %s %d %d %d %d %f\n",__FILE__,__FUNCTION__,__LINE__,k,wave_data->apd[i - 1],wave_data->apd[i],first_diff[k]);
-        }
+  for (c = 0 ; c < WAVE_CHANNELS ; c++)
+    {
+      runs = &result->channel[c];
 
-      for (i = 1, k = 0 ; i < size_first ; i++, k++)
-        {
-          second_diff[k] = first_diff[i] - first_diff[i - 1];
-          fprintf(stderr, "%s %s %d %d %f\n",__FILE__,__FUNCTION__,__LINE__,k,second_diff[k]);
-        }
+      fprintf (txt_fp, ",%d", runs->count);
 
-      free (first_diff);
-      free (second_diff);
+      for (j = 0 ; j < 2 ; j++)
+        fprintf (txt_fp, ",%d,%d,%d,%.1f,%.1f,%d", runs->start[j], runs->rise[j], runs->run[j], runs->max_slope[j], runs->max_curvature[j],
+                 runs->inflections[j]);
     }
 
-  return (NVTrue);
+  fprintf (txt_fp, "\n");
 }
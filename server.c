@@ -0,0 +1,411 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+#ifndef NVWIN3X
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+
+/*  A client has this many seconds between reads to send its request before the connection is dropped.  */
+
+#define SERVER_TIMEOUT         60
+
+
+/*  Admission control state shared by all of the connection threads.  connections is the number of connection threads  */
+/*  alive (reading a request, waiting for a slot, or running), active is the number of queries running.  */
+
+static pthread_mutex_t   admit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    admit_cond = PTHREAD_COND_INITIALIZER;
+static int32_t           active = 0, connections = 0;
+static char              server_socket[512];
+
+
+
+static void server_exit (int sig __attribute__ ((unused)))
+{
+  unlink (server_socket);
+  _exit (0);
+}
+
+
+
+/*  Called from the accept loop before a connection thread is started.  No more than max_active + max_waiting  */
+/*  connections are allowed at once (running or waiting) so the number of threads, and the requests they're holding,  */
+/*  is bounded.  Returns NVFalse if we're full.  */
+
+static uint8_t admit_connection ()
+{
+  uint8_t        admitted = NVFalse;
+
+
+  pthread_mutex_lock (&admit_mutex);
+
+  if (connections < options.max_active + options.max_waiting)
+    {
+      connections++;
+      admitted = NVTrue;
+    }
+
+  pthread_mutex_unlock (&admit_mutex);
+
+  return (admitted);
+}
+
+
+
+static void release_connection ()
+{
+  pthread_mutex_lock (&admit_mutex);
+  connections--;
+  pthread_mutex_unlock (&admit_mutex);
+}
+
+
+
+/*  Wait for a free query slot.  The connection has already been admitted so there's always room to wait.  */
+
+static void admit_query ()
+{
+  pthread_mutex_lock (&admit_mutex);
+
+  while (active >= options.max_active) pthread_cond_wait (&admit_cond, &admit_mutex);
+
+  active++;
+
+  pthread_mutex_unlock (&admit_mutex);
+}
+
+
+
+static void release_query ()
+{
+  pthread_mutex_lock (&admit_mutex);
+  active--;
+  pthread_cond_signal (&admit_cond);
+  pthread_mutex_unlock (&admit_mutex);
+}
+
+
+
+/*  Read the area from the client.  Each line is a "lat lon" (or "lat, lon") pair in decimal degrees, a line starting  */
+/*  with RING starts a new ring (inner rings are holes), a "TIME start end" line adds a time window (see  */
+/*  time_window.c), and the request is terminated by a line containing END.  Lines that don't fit in the buffer are  */
+/*  rejected rather than being split into two lines.  */
+
+static uint8_t read_request (FILE *in_fp, QUERY *query, char *error)
+{
+  char           string[256], *ptr, *end;
+  double         lat, lon;
+
+
+  while (fgets (string, sizeof (string), in_fp) != NULL)
+    {
+      if (strchr (string, '\n') == NULL && !feof (in_fp))
+        {
+          sprintf (error, "line longer than %d characters", (int32_t) sizeof (string) - 2);
+          return (NVFalse);
+        }
+
+      ptr = string;
+      while (*ptr == ' ' || *ptr == '\t') ptr++;
+
+      if (*ptr == '\n' || *ptr == '\r' || !*ptr) continue;
+
+      if (!strncmp (ptr, "RING", 4))
+        {
+          if (!new_area_ring (&query->area))
+            {
+              strcpy (error, "out of memory");
+              return (NVFalse);
+            }
+          continue;
+        }
+
+      if (!strncmp (ptr, "TIME", 4))
+        {
+          if (!add_time_window (query, ptr + 4))
+            {
+              sprintf (error, "bad time window - %s", string);
+              return (NVFalse);
+            }
+          continue;
+        }
+
+      if (!strncmp (ptr, "END", 3))
+        {
+          if (!close_area (&query->area) || query->area.dropped_rings)
+            {
+              strcpy (error, "every ring needs at least 3 points");
+              return (NVFalse);
+            }
+
+          build_area_index (&query->area);
+
+          return (NVTrue);
+        }
+
+      lat = strtod (ptr, &end);
+      if (end == ptr)
+        {
+          sprintf (error, "unable to parse line - %s", string);
+          return (NVFalse);
+        }
+
+      ptr = end;
+      while (*ptr == ' ' || *ptr == '\t' || *ptr == ',') ptr++;
+
+      lon = strtod (ptr, &end);
+      if (end == ptr)
+        {
+          sprintf (error, "unable to parse line - %s", string);
+          return (NVFalse);
+        }
+
+      if (!add_area_point (&query->area, lon, lat))
+        {
+          strcpy (error, "out of memory");
+          return (NVFalse);
+        }
+    }
+
+  if (ferror (in_fp) && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      strcpy (error, "timed out waiting for the request");
+    }
+  else
+    {
+      strcpy (error, "connection closed before END");
+    }
+
+  return (NVFalse);
+}
+
+
+
+/*  Handle a single client connection.  One of these threads is started for each admitted connection.  */
+
+static void *serve_connection (void *arg)
+{
+  int32_t        fd, count;
+  FILE           *in_fp, *out_fp;
+  QUERY          *query;
+  char           error[512];
+  struct timeval timeout;
+  uint8_t        listed;
+
+
+  fd = (int32_t) (intptr_t) arg;
+
+
+  /*  Don't let a client that never finishes its request hold on to a connection slot.  */
+
+  timeout.tv_sec = SERVER_TIMEOUT;
+  timeout.tv_usec = 0;
+  if (setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout)) < 0) perror ("setsockopt");
+
+  in_fp = fdopen (fd, "r");
+  out_fp = fdopen (dup (fd), "w");
+
+  if (in_fp == NULL || out_fp == NULL)
+    {
+      if (in_fp != NULL) fclose (in_fp);
+      else close (fd);
+      if (out_fp != NULL) fclose (out_fp);
+      release_connection ();
+      return (NULL);
+    }
+
+  listed = reserve_memory (MAX_PFM_FILES * sizeof (LIST_NUM), NVFalse);
+
+  query = (QUERY *) calloc (1, sizeof (QUERY));
+  if (query != NULL && listed) query->list = (LIST_NUM *) calloc (MAX_PFM_FILES, sizeof (LIST_NUM));
+
+  if (!listed)
+    {
+      fprintf (out_fp, "ERROR the query doesn't fit in the memory budget\n");
+    }
+  else if (query == NULL || query->list == NULL || !init_area (&query->area))
+    {
+      fprintf (out_fp, "ERROR out of memory\n");
+    }
+  else if (!read_request (in_fp, query, error))
+    {
+      fprintf (out_fp, "ERROR %s\n", error);
+    }
+  else
+    {
+      admit_query ();
+
+      query->txt_fp = out_fp;
+      query->progress = NVFalse;
+
+      count = extract_area (query);
+
+      release_query ();
+
+      if (count < 0)
+        {
+          fprintf (out_fp, "ERROR extraction failed\n");
+        }
+      else
+        {
+          fprintf (out_fp, "DONE %d\n", count);
+        }
+    }
+
+  if (query != NULL)
+    {
+      free_area (&query->area);
+      free (query->list);
+      free (query->windows);
+      free (query);
+    }
+
+  if (listed) release_memory (MAX_PFM_FILES * sizeof (LIST_NUM));
+
+  fclose (out_fp);
+  fclose (in_fp);
+
+  release_connection ();
+
+  return (NULL);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        run_server                                          *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Resident query server.  The PFM and the file index  *
+*                       stay open and area queries are accepted over a      *
+*                       Unix domain socket.  Each connection sends one area *
+*                       and gets the results streamed back followed by a    *
+*                       DONE (or ERROR/BUSY) line.  No more than            *
+*                       max_active queries run at once and no more than     *
+*                       max_waiting connections are allowed to wait (or     *
+*                       send their request).  Anything past that is turned  *
+*                       away with BUSY before a thread is started for it.   *
+*                                                                           *
+*   Arguments:          socket_path    - path of the socket to create       *
+*                                                                           *
+*   Returns:            -1 on error, doesn't return otherwise               *
+*                                                                           *
+\***************************************************************************/
+
+int32_t run_server (char *socket_path)
+{
+  struct sockaddr_un     addr;
+  int32_t                listen_fd, fd;
+  pthread_t              thread;
+  pthread_attr_t         attr;
+
+
+  if (strlen (socket_path) >= sizeof (addr.sun_path))
+    {
+      fprintf (stderr, "\n\nSocket path %s is too long\n\n", socket_path);
+      return (-1);
+    }
+
+  strcpy (server_socket, socket_path);
+
+
+  /*  We don't want a client that goes away to kill the server.  */
+
+  signal (SIGPIPE, SIG_IGN);
+  signal (SIGINT, server_exit);
+  signal (SIGTERM, server_exit);
+
+
+  if ((listen_fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+      perror ("socket");
+      return (-1);
+    }
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, socket_path);
+
+  unlink (socket_path);
+
+  if (bind (listen_fd, (struct sockaddr *) &addr, sizeof (addr)) < 0 || listen (listen_fd, 64) < 0)
+    {
+      perror (socket_path);
+      close (listen_fd);
+      return (-1);
+    }
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+  fprintf (stderr, "Listening on %s (%d active, %d waiting)\n", socket_path, options.max_active, options.max_waiting);
+  fflush (stderr);
+
+  while (1)
+    {
+      if ((fd = accept (listen_fd, NULL, NULL)) < 0)
+        {
+          if (errno == EINTR) continue;
+          perror ("accept");
+          break;
+        }
+
+      if (!admit_connection ())
+        {
+          if (write (fd, "BUSY\n", 5) < 0) perror ("write");
+          close (fd);
+          continue;
+        }
+
+      if (pthread_create (&thread, &attr, serve_connection, (void *) (intptr_t) fd))
+        {
+          perror ("pthread_create");
+          release_connection ();
+          close (fd);
+        }
+    }
+
+  close (listen_fd);
+  unlink (socket_path);
+
+  return (-1);
+}
+
+#else
+
+int32_t run_server (char *socket_path __attribute__ ((unused)))
+{
+  fprintf (stderr, "\n\nServer mode is not supported on Windows\n\n");
+  return (-1);
+}
+
+#endif
@@ -0,0 +1,502 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+
+/*  A shard is one of N independent pfm_waveform runs that each extract from a subset of the input files.  Each  */
+/*  shard writes its own partial output file and, only after that has been completely written, a manifest that lists  */
+/*  where the output for each input file is in the partial output.  The merge step reads the manifests and copies the  */
+/*  per file segments into the final output in input file number order, which is the order a single run would have  */
+/*  written them in.  Shards don't share anything that they write so a failed shard can just be run again.  */
+/*  */
+/*  Each manifest also has the key of the run (query_digest without the file selection plus the name, size, and  */
+/*  modification time of every HOF input file), the number and a digest of the input files the whole run covers, and  */
+/*  the input files this shard was responsible for.  The merge refuses shards whose keys or plans don't agree (a  */
+/*  stale shard, or one run with a different PFM, area, time window, or -F list), shards that overlap, and sets of  */
+/*  shards that don't cover every input file.  */
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        parse_shard                                         *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Parse a shard specification of the form K/N where   *
+*                       K is from 1 to N.                                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t parse_shard (char *string, int32_t *shard, int32_t *shard_count)
+{
+  if (sscanf (string, "%d/%d", shard, shard_count) != 2 || *shard_count < 1 || *shard < 1 || *shard > *shard_count) return (NVFalse);
+
+  return (NVTrue);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        parse_file_numbers                                  *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Set the file mask from a comma separated list of    *
+*                       PFM input file numbers and ranges (e.g. 0,4,7-12).  *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t parse_file_numbers (char *string)
+{
+  char           *ptr, *end;
+  int32_t        i, start, stop;
+
+
+  if (options.file_mask == NULL)
+    {
+      if ((options.file_mask = (uint8_t *) calloc (MAX_PFM_FILES, sizeof (uint8_t))) == NULL)
+        {
+          perror ("Allocating file mask");
+          exit (-1);
+        }
+    }
+
+  ptr = string;
+  while (*ptr)
+    {
+      start = stop = strtol (ptr, &end, 10);
+      if (end == ptr) return (NVFalse);
+
+      ptr = end;
+      if (*ptr == '-')
+        {
+          ptr++;
+          stop = strtol (ptr, &end, 10);
+          if (end == ptr) return (NVFalse);
+          ptr = end;
+        }
+
+      if (start < 0 || stop >= MAX_PFM_FILES || stop < start) return (NVFalse);
+
+      for (i = start ; i <= stop ; i++) options.file_mask[i] = 1;
+
+      if (*ptr == ',') ptr++;
+      else if (*ptr) return (NVFalse);
+    }
+
+  return (NVTrue);
+}
+
+
+
+/*  Partial output and manifest file names for a shard.  */
+
+void shard_file_names (char *areafile, int32_t shard, int32_t shard_count, char *txt_file, char *manifest_file)
+{
+  char           base[512];
+
+
+  strcpy (base, pfm_basename (areafile));
+  base[strlen (base) - 4] = 0;
+
+  sprintf (txt_file, "%s.shard_%d_of_%d.pts", base, shard, shard_count);
+  sprintf (manifest_file, "%s.shard_%d_of_%d.man", base, shard, shard_count);
+}
+
+
+
+/*  Digest of the input file numbers the shards are meant to cover between them (every HOF file).  */
+
+static uint64_t plan_files (int32_t *count)
+{
+  uint64_t       hash = FNV_OFFSET;
+  int32_t        i;
+
+
+  *count = 0;
+  for (i = 0 ; i < options.file_count ; i++)
+    {
+      if (options.file_index[i].type != PFM_CHARTS_HOF_DATA) continue;
+
+      hash = fnv (hash, &i, sizeof (int32_t));
+      (*count)++;
+    }
+
+  return (hash);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        write_manifest                                      *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Write the manifest for a finished shard.  This      *
+*                       must only be called after the partial output has    *
+*                       been flushed.  The manifest is written to a         *
+*                       temporary file and renamed so that a manifest only  *
+*                       exists if the shard completed.                      *
+*                                                                           *
+*   Arguments:          manifest_file  - manifest file name                 *
+*                       shard          - this shard (1 to shard_count)      *
+*                       shard_count    - number of shards                   *
+*                       query          - the finished query                 *
+*                       icount         - number of waveforms extracted      *
+*                       key            - query_digest without the file      *
+*                                        selection                          *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t write_manifest (char *manifest_file, int32_t shard, int32_t shard_count, QUERY *query, int32_t icount, uint64_t key)
+{
+  FILE           *fp;
+  char           tmp_file[528];
+  int32_t        i, plan_count;
+  uint64_t       plan;
+  struct stat    hof_stat;
+
+
+  /*  Every shard has to have been run against the same HOF files.  */
+
+  for (i = 0 ; i < options.file_count ; i++)
+    {
+      if (options.file_index[i].type != PFM_CHARTS_HOF_DATA) continue;
+
+      if (stat (options.file_index[i].path, &hof_stat)) memset (&hof_stat, 0, sizeof (struct stat));
+
+      key = fnv (key, options.file_index[i].path, strlen (options.file_index[i].path));
+      key = fnv (key, &hof_stat.st_size, sizeof (hof_stat.st_size));
+      key = fnv (key, &hof_stat.st_mtime, sizeof (hof_stat.st_mtime));
+    }
+
+  plan = plan_files (&plan_count);
+
+
+  sprintf (tmp_file, "%s.tmp", manifest_file);
+
+  if ((fp = fopen (tmp_file, "w")) == NULL)
+    {
+      perror (tmp_file);
+      return (NVFalse);
+    }
+
+  fprintf (fp, "# pfm_waveform shard manifest\n");
+  fprintf (fp, "SHARD %d %d\n", shard, shard_count);
+  fprintf (fp, "KEY %016"PRIx64"\n", key);
+  fprintf (fp, "PLAN %d %016"PRIx64"\n", plan_count, plan);
+
+  for (i = 0 ; i < options.file_count ; i++)
+    {
+      if (want_file (i)) fprintf (fp, "FILE %d\n", i);
+    }
+
+  for (i = 0 ; i < query->segment_count ; i++)
+    fprintf (fp, "SEGMENT %d %d %"PRId64" %"PRId64"\n", query->segments[i].file_number, query->segments[i].count,
+             query->segments[i].offset, query->segments[i].length);
+
+  fprintf (fp, "COMPLETE %d\n", icount);
+
+  if (fclose (fp) || rename (tmp_file, manifest_file))
+    {
+      perror (manifest_file);
+      remove (tmp_file);
+      return (NVFalse);
+    }
+
+  return (NVTrue);
+}
+
+
+
+typedef struct
+{
+  SEGMENT       segment;
+  int32_t       shard;
+} SHARD_SEGMENT;
+
+
+static int32_t compare_segments (const void *a, const void *b)
+{
+  const SHARD_SEGMENT *sa = (const SHARD_SEGMENT *) a, *sb = (const SHARD_SEGMENT *) b;
+
+  return (sa->segment.file_number - sb->segment.file_number);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        merge_shards                                        *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Combine the partial outputs of shard_count shards   *
+*                       into the output file that a single run would have   *
+*                       produced.  Every shard must have a complete         *
+*                       manifest, all of the manifests must have the same   *
+*                       key and plan, and between them the shards must      *
+*                       cover every input file in the plan exactly once.    *
+*                                                                           *
+*   Arguments:          areafile       - area file used for the shards      *
+*                       shard_count    - number of shards                   *
+*                                                                           *
+*   Returns:            Number of waveforms or -1 on error                  *
+*                                                                           *
+\***************************************************************************/
+
+int32_t merge_shards (char *areafile, int32_t shard_count)
+{
+  FILE                   *fp, *out_fp, **shard_fp;
+  char                   txt_file[512], manifest_file[512], tmp_file[528], string[512], buffer[65536];
+  int32_t                i, shard, count, icount = 0, segment_count = 0, max_segments = MAX_PFM_FILES, missing = 0, n, m;
+  int32_t                file_number, plan_count = -1, shard_plan_count, covered, *owner;
+  int64_t                remaining;
+  uint64_t               key = 0, plan = 0, shard_key, shard_plan, hash;
+  SHARD_SEGMENT          *segments;
+  SEGMENT                seg;
+  uint8_t                complete, have_key, have_plan;
+
+
+  if ((segments = (SHARD_SEGMENT *) malloc (max_segments * sizeof (SHARD_SEGMENT))) == NULL ||
+      (shard_fp = (FILE **) calloc (shard_count, sizeof (FILE *))) == NULL ||
+      (owner = (int32_t *) calloc (MAX_PFM_FILES, sizeof (int32_t))) == NULL)
+    {
+      perror ("Allocating shard segments");
+      return (-1);
+    }
+
+
+  /*  Read all of the manifests.  */
+
+  for (shard = 1 ; shard <= shard_count ; shard++)
+    {
+      shard_file_names (areafile, shard, shard_count, txt_file, manifest_file);
+
+      complete = have_key = have_plan = NVFalse;
+
+      if ((fp = fopen (manifest_file, "r")) != NULL)
+        {
+          while (fgets (string, sizeof (string), fp) != NULL)
+            {
+              if (!strncmp (string, "KEY ", 4))
+                {
+                  have_key = (sscanf (string + 4, "%"SCNx64, &shard_key) == 1);
+                }
+              else if (!strncmp (string, "PLAN ", 5))
+                {
+                  have_plan = (sscanf (string + 5, "%d %"SCNx64, &shard_plan_count, &shard_plan) == 2);
+                }
+              else if (!strncmp (string, "FILE ", 5))
+                {
+                  if (sscanf (string + 5, "%d", &file_number) != 1 || file_number < 0 || file_number >= MAX_PFM_FILES) break;
+
+                  if (owner[file_number])
+                    {
+                      fprintf (stderr, "\n\nInput file %d is in shards %d and %d\n\n", file_number, owner[file_number], shard);
+                      icount = -1;
+                      fclose (fp);
+                      goto CLEANUP;
+                    }
+
+                  owner[file_number] = shard;
+                }
+              else if (!strncmp (string, "SEGMENT ", 8))
+                {
+                  if (sscanf (string + 8, "%d %d %"SCNd64" %"SCNd64, &seg.file_number, &seg.count, &seg.offset, &seg.length) != 4) break;
+
+                  if (segment_count == max_segments)
+                    {
+                      max_segments *= 2;
+                      segments = (SHARD_SEGMENT *) realloc (segments, max_segments * sizeof (SHARD_SEGMENT));
+                      if (segments == NULL)
+                        {
+                          perror ("Allocating shard segments");
+                          exit (-1);
+                        }
+                    }
+
+                  segments[segment_count].segment = seg;
+                  segments[segment_count].shard = shard;
+                  segment_count++;
+                }
+              else if (!strncmp (string, "COMPLETE ", 9) && sscanf (string + 9, "%d", &count) == 1)
+                {
+                  icount += count;
+                  complete = NVTrue;
+                }
+            }
+
+          fclose (fp);
+        }
+
+
+      /*  Manifests from before the key and plan were added can't be checked so they're treated as incomplete.  */
+
+      if (complete && (!have_key || !have_plan))
+        {
+          fprintf (stderr, "Shard %d of %d has no key or plan in its manifest\n", shard, shard_count);
+          complete = NVFalse;
+        }
+
+      if (complete)
+        {
+          if (plan_count < 0)
+            {
+              key = shard_key;
+              plan = shard_plan;
+              plan_count = shard_plan_count;
+            }
+          else if (shard_key != key || shard_plan != plan || shard_plan_count != plan_count)
+            {
+              fprintf (stderr, "\n\nShard %d of %d doesn't match shard 1 (different PFM, area, time windows, or input\n", shard,
+                       shard_count);
+              fprintf (stderr, "files, or left over from an earlier run).  Rerun the shards that are out of date.\n\n");
+              icount = -1;
+              goto CLEANUP;
+            }
+        }
+
+      if (complete) shard_fp[shard - 1] = fopen (txt_file, "rb");
+
+      if (!complete || shard_fp[shard - 1] == NULL)
+        {
+          fprintf (stderr, "Shard %d of %d is missing or incomplete, rerun it with -S %d/%d\n", shard, shard_count, shard, shard_count);
+          missing++;
+        }
+    }
+
+  fflush (stderr);
+
+  if (missing)
+    {
+      icount = -1;
+      goto CLEANUP;
+    }
+
+
+  /*  Between them the shards have to cover every file in the plan.  */
+
+  hash = FNV_OFFSET;
+  covered = 0;
+  for (i = 0 ; i < MAX_PFM_FILES ; i++)
+    {
+      if (!owner[i]) continue;
+
+      hash = fnv (hash, &i, sizeof (int32_t));
+      covered++;
+    }
+
+  if (covered != plan_count || hash != plan)
+    {
+      fprintf (stderr, "\n\nThe shards cover %d input files but the run has %d, the shards weren't all run with the same\n",
+               covered, plan_count);
+      fprintf (stderr, "-S or -F settings.\n\n");
+      icount = -1;
+      goto CLEANUP;
+    }
+
+
+  /*  Put the segments back into input file order.  Each file's output has to come from the shard that owns it.  */
+
+  qsort (segments, segment_count, sizeof (SHARD_SEGMENT), compare_segments);
+
+  for (i = 0 ; i < segment_count ; i++)
+    {
+      if (owner[segments[i].segment.file_number] != segments[i].shard)
+        {
+          fprintf (stderr, "\n\nShard %d has output for input file %d which it doesn't own\n\n", segments[i].shard,
+                   segments[i].segment.file_number);
+          icount = -1;
+          goto CLEANUP;
+        }
+    }
+
+  for (i = 1 ; i < segment_count ; i++)
+    {
+      if (segments[i].segment.file_number == segments[i - 1].segment.file_number)
+        {
+          fprintf (stderr, "\n\nInput file %d was extracted by shards %d and %d\n\n", segments[i].segment.file_number,
+                   segments[i - 1].shard, segments[i].shard);
+          icount = -1;
+          goto CLEANUP;
+        }
+    }
+
+
+  strcpy (txt_file, pfm_basename (areafile));
+  strcpy (&txt_file[strlen (txt_file) - 4], ".pts");
+  sprintf (tmp_file, "%s.tmp", txt_file);
+
+  if ((out_fp = fopen (tmp_file, "wb")) == NULL)
+    {
+      perror (tmp_file);
+      icount = -1;
+      goto CLEANUP;
+    }
+
+  for (i = 0 ; i < segment_count ; i++)
+    {
+      fp = shard_fp[segments[i].shard - 1];
+
+      fseeko (fp, segments[i].segment.offset, SEEK_SET);
+
+      for (remaining = segments[i].segment.length ; remaining > 0 ; remaining -= n)
+        {
+          m = remaining < (int64_t) sizeof (buffer) ? (int32_t) remaining : (int32_t) sizeof (buffer);
+
+          if ((n = fread (buffer, 1, m, fp)) != m || (int32_t) fwrite (buffer, 1, n, out_fp) != n)
+            {
+              fprintf (stderr, "\n\nShort read or write copying input file %d from shard %d\n\n", segments[i].segment.file_number,
+                       segments[i].shard);
+              fclose (out_fp);
+              remove (tmp_file);
+              icount = -1;
+              goto CLEANUP;
+            }
+        }
+    }
+
+  if (fclose (out_fp) || rename (tmp_file, txt_file))
+    {
+      perror (txt_file);
+      remove (tmp_file);
+      icount = -1;
+    }
+
+
+ CLEANUP:
+
+  for (shard = 0 ; shard < shard_count ; shard++)
+    {
+      if (shard_fp[shard] != NULL) fclose (shard_fp[shard]);
+    }
+  free (shard_fp);
+  free (segments);
+  free (owner);
+
+  return (icount);
+}
@@ -0,0 +1,605 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include <unistd.h>
+
+#include "pfm_waveform.h"
+
+
+/*  Unit tests for the option parsers, the time windows, the area point in polygon test, and process_waveforms.  */
+/*  inside_area is checked against the nvutility inside_polygon2 that pfm_waveform used to use and process_waveforms  */
+/*  against a copy of the run detection from the original (1.04) process_waveforms.  Each failed check is printed and  */
+/*  the exit status is the number of failed checks.  */
+
+
+OPTIONS                options;
+
+static int32_t         checks = 0, failures = 0;
+static uint32_t        seed = 12345;
+
+
+#define CHECK(test) do {checks++; if (!(test)) {failures++; \
+      fprintf (stderr, "%s:%d: CHECK (%s) failed\n", __FILE__, __LINE__, #test);}} while (0)
+
+
+/*  Our own random numbers so the tests do the same thing everywhere.  */
+
+static double uniform (double low, double high)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+
+  return (low + (high - low) * ((double) seed / 4294967296.0));
+}
+
+
+
+/*  These stand in for charts_io.c so that the time window test only needs a HOF file of the right size.  There are  */
+/*  two records to a second starting at TEST_TIME.  Nothing here reads waveforms.  */
+
+#define TEST_TIME     1286451000
+#define TEST_RECORDS  100
+
+FILE *charts_open_hof (char *path)
+{
+  return (fopen (path, "rb"));
+}
+
+
+uint8_t charts_read_hof (FILE *fp __attribute__ ((unused)), int32_t rec, HYDRO_OUTPUT_T *hof)
+{
+  memset (hof, 0, sizeof (HYDRO_OUTPUT_T));
+  hof->timestamp = ((int64_t) TEST_TIME + (rec - 1) / 2) * 1000000;
+
+  return (NVTrue);
+}
+
+
+FILE *charts_open_wave (char *path __attribute__ ((unused)), WAVE_HEADER_T *header __attribute__ ((unused)))
+{
+  return (NULL);
+}
+
+
+uint8_t charts_read_wave (FILE *fp __attribute__ ((unused)), int32_t rec __attribute__ ((unused)),
+                          WAVE_DATA_T *data __attribute__ ((unused)))
+{
+  return (NVFalse);
+}
+
+
+void charts_close (FILE *fp)
+{
+  if (fp != NULL) fclose (fp);
+}
+
+
+
+static void test_time_windows ()
+{
+  QUERY          query;
+  PING_RANGE     *ranges;
+  FILE           *fp;
+  char           string[128];
+  uint8_t        want[TEST_RECORDS + 1], got[TEST_RECORDS + 1];
+  int32_t        i, j, k, w, count;
+  int64_t        t;
+
+
+  memset (&query, 0, sizeof (QUERY));
+
+
+  /*  Both time formats, and windows that don't parse aren't added.  */
+
+  CHECK (add_time_window (&query, "1286451000.5,1286451001"));
+  CHECK (query.window_count == 1 && query.windows[0].start == 1286451000500000LL && query.windows[0].end == 1286451001000000LL);
+
+  CHECK (add_time_window (&query, "2010-10-07T11:30:00.25, 2010-10-07T11:30:01"));
+  CHECK (query.window_count == 2 && query.windows[1].start == 1286451000250000LL && query.windows[1].end == 1286451001000000LL);
+
+  CHECK (!add_time_window (&query, "abc,def"));
+  CHECK (!add_time_window (&query, "1286451005,1286451004"));
+  CHECK (!add_time_window (&query, "1286451005"));
+  CHECK (query.window_count == 2);
+
+  free (query.windows);
+  query.windows = NULL;
+  query.window_count = 0;
+
+
+  /*  A HOF file that's just the header and TEST_RECORDS empty records.  */
+
+  if ((options.file_index = (FILE_INDEX *) calloc (1, sizeof (FILE_INDEX))) == NULL)
+    {
+      perror ("Allocating file index");
+      exit (-1);
+    }
+
+  sprintf (options.file_index[0].path, "pfm_waveform_test_%d.hof", (int32_t) getpid ());
+
+  if ((fp = fopen (options.file_index[0].path, "wb")) == NULL)
+    {
+      perror (options.file_index[0].path);
+      exit (-1);
+    }
+
+  fseek (fp, HOF_HEAD_SIZE + TEST_RECORDS * sizeof (HYDRO_OUTPUT_T) - 1, SEEK_SET);
+  fputc (0, fp);
+  fclose (fp);
+
+
+  /*  Records 21 to 26 are in the first window and 25 to 42 in the second.  The third is after the end of the file.  */
+
+  CHECK (add_time_window (&query, "1286451010,1286451012"));
+  CHECK (add_time_window (&query, "1286451011.5,1286451020"));
+  CHECK (add_time_window (&query, "1286452000,1286453000"));
+
+  ranges = (PING_RANGE *) malloc (3 * sizeof (PING_RANGE));
+  ranges[0].start = 1;
+  ranges[0].end = 22;
+  ranges[1].start = 30;
+  ranges[1].end = 35;
+  ranges[2].start = 40;
+  ranges[2].end = 100;
+  count = 3;
+
+  CHECK (apply_time_windows (&query, 0, &ranges, &count) == 3);
+  CHECK (count == 3 && ranges[0].start == 21 && ranges[0].end == 22 && ranges[1].start == 30 && ranges[1].end == 35 &&
+         ranges[2].start == 40 && ranges[2].end == 42);
+
+  free (ranges);
+
+
+  /*  Random windows and ranges against checking every record.  */
+
+  for (k = 0 ; k < 500 ; k++)
+    {
+      free (query.windows);
+      query.windows = NULL;
+      query.window_count = 0;
+
+      for (i = (int32_t) uniform (1.0, 4.0) ; i > 0 ; i--)
+        {
+          t = TEST_TIME - 5 + (int64_t) uniform (0.0, 60.0);
+          sprintf (string, "%"PRId64".%d,%"PRId64, t, (int32_t) uniform (0.0, 2.0) * 5, t + 1 + (int64_t) uniform (0.0, 20.0));
+          CHECK (add_time_window (&query, string));
+        }
+
+      ranges = (PING_RANGE *) malloc (TEST_RECORDS * sizeof (PING_RANGE));
+      memset (want, 0, sizeof (want));
+
+      count = 0;
+      for (i = 1 ; i <= TEST_RECORDS ; i = ranges[count++].end + 1 + (int32_t) uniform (1.0, 8.0))
+        {
+          ranges[count].start = i;
+          ranges[count].end = i + (int32_t) uniform (0.0, 12.0);
+          if (ranges[count].end > TEST_RECORDS) ranges[count].end = TEST_RECORDS;
+
+          for (j = ranges[count].start ; j <= ranges[count].end ; j++)
+            {
+              t = ((int64_t) TEST_TIME + (j - 1) / 2) * 1000000;
+
+              for (w = 0 ; w < query.window_count ; w++)
+                {
+                  if (t >= query.windows[w].start && t <= query.windows[w].end) want[j] = 1;
+                }
+            }
+        }
+
+      CHECK (apply_time_windows (&query, 0, &ranges, &count) == count);
+
+      memset (got, 0, sizeof (got));
+      for (i = 0 ; i < count ; i++)
+        {
+          CHECK (ranges[i].start <= ranges[i].end && (!i || ranges[i].start > ranges[i - 1].end));
+          for (j = ranges[i].start ; j <= ranges[i].end ; j++) got[j] = 1;
+        }
+
+      CHECK (!memcmp (want, got, sizeof (want)));
+
+      free (ranges);
+    }
+
+  remove (options.file_index[0].path);
+  free (options.file_index);
+  options.file_index = NULL;
+  free (query.windows);
+}
+
+
+
+static void test_shards ()
+{
+  int32_t        i, shard, shard_count;
+  char           string[32];
+
+
+  CHECK (parse_shard ("2/5", &shard, &shard_count) && shard == 2 && shard_count == 5);
+  CHECK (parse_shard ("1/1", &shard, &shard_count) && shard == 1 && shard_count == 1);
+  CHECK (!parse_shard ("0/5", &shard, &shard_count));
+  CHECK (!parse_shard ("6/5", &shard, &shard_count));
+  CHECK (!parse_shard ("1/0", &shard, &shard_count));
+  CHECK (!parse_shard ("3", &shard, &shard_count));
+
+
+  CHECK (parse_file_numbers ("0,4,7-9"));
+  for (i = 0 ; i < MAX_PFM_FILES ; i++) CHECK (options.file_mask[i] == (i == 0 || i == 4 || (i >= 7 && i <= 9)));
+
+  memset (options.file_mask, 0, MAX_PFM_FILES);
+
+  sprintf (string, "%d", MAX_PFM_FILES - 1);
+  CHECK (parse_file_numbers (string) && options.file_mask[MAX_PFM_FILES - 1]);
+
+  sprintf (string, "0-%d", MAX_PFM_FILES);
+  CHECK (!parse_file_numbers (string));
+  CHECK (!parse_file_numbers ("3-1"));
+  CHECK (!parse_file_numbers ("-1"));
+  CHECK (!parse_file_numbers ("1;2"));
+  CHECK (!parse_file_numbers ("1,a"));
+
+  free (options.file_mask);
+  options.file_mask = NULL;
+}
+
+
+
+static void test_memory_size ()
+{
+  int64_t        bytes;
+
+
+  CHECK (parse_memory_size ("512", &bytes) && bytes == 512);
+  CHECK (parse_memory_size ("2K", &bytes) && bytes == 2048);
+  CHECK (parse_memory_size ("64kB", &bytes) && bytes == 65536);
+  CHECK (parse_memory_size ("1.5M", &bytes) && bytes == 1572864);
+  CHECK (parse_memory_size ("10MB", &bytes) && bytes == 10485760);
+  CHECK (parse_memory_size ("2G", &bytes) && bytes == 2147483648LL);
+  CHECK (!parse_memory_size ("", &bytes));
+  CHECK (!parse_memory_size ("M", &bytes));
+  CHECK (!parse_memory_size ("0", &bytes));
+  CHECK (!parse_memory_size ("-1K", &bytes));
+  CHECK (!parse_memory_size ("5X", &bytes));
+  CHECK (!parse_memory_size ("5KBB", &bytes));
+}
+
+
+
+/*  A random star shaped ring (or, if scrambled, one whose edges cross) of count points around cx, cy.  */
+
+static void random_ring (AREA *area, double *x, double *y, int32_t count, double cx, double cy, double radius, uint8_t scramble)
+{
+  int32_t        i, j;
+  double         angle, r, t;
+
+
+  for (i = 0 ; i < count ; i++)
+    {
+      angle = 2.0 * M_PI * (i + uniform (0.0, 0.9)) / count;
+      r = radius * uniform (0.3, 1.0);
+      x[i] = cx + r * cos (angle);
+      y[i] = cy + r * sin (angle);
+    }
+
+  if (scramble)
+    {
+      for (i = count - 1 ; i > 0 ; i--)
+        {
+          j = (int32_t) uniform (0.0, i + 1.0);
+          t = x[i];
+          x[i] = x[j];
+          x[j] = t;
+          t = y[i];
+          y[i] = y[j];
+          y[j] = t;
+        }
+    }
+
+  for (i = 0 ; i < count ; i++) CHECK (add_area_point (area, x[i], y[i]));
+}
+
+
+
+static void test_area ()
+{
+  AREA           area;
+  double         *x[2], *y[2], px, py;
+  int32_t        i, k, pass, count[2], rings, mismatches;
+  uint8_t        want;
+
+
+  x[0] = (double *) malloc (5000 * sizeof (double));
+  y[0] = (double *) malloc (5000 * sizeof (double));
+  x[1] = (double *) malloc (5000 * sizeof (double));
+  y[1] = (double *) malloc (5000 * sizeof (double));
+
+
+  /*  Simple, large, holed, and self crossing areas, each with and without the slab index.  */
+
+  for (k = 0 ; k < 60 ; k++)
+    {
+      rings = (k % 3 == 1) ? 2 : 1;
+      count[0] = (k % 10 == 0) ? 5000 : (int32_t) uniform (3.0, 200.0);
+      count[1] = (int32_t) uniform (3.0, 50.0);
+
+      for (pass = 0 ; pass < 2 ; pass++)
+        {
+          CHECK (init_area (&area));
+
+          seed = 1000 + k;
+          random_ring (&area, x[0], y[0], count[0], -80.0, 30.0, 0.5, k % 3 == 2);
+
+          if (rings == 2)
+            {
+              CHECK (new_area_ring (&area));
+              random_ring (&area, x[1], y[1], count[1], -80.0, 30.0, 0.14, NVFalse);
+            }
+
+          CHECK (close_area (&area) && area.ring_count == rings);
+
+          if (pass) build_area_index (&area);
+
+          mismatches = 0;
+          for (i = 0 ; i < 4000 ; i++)
+            {
+              px = uniform (-80.6, -79.4);
+              py = uniform (29.4, 30.6);
+
+              want = inside_polygon2 (x[0], y[0], count[0], px, py);
+              if (rings == 2 && inside_polygon2 (x[1], y[1], count[1], px, py)) want = !want;
+
+              if (inside_area (&area, px, py) != want) mismatches++;
+            }
+
+          if (mismatches) fprintf (stderr, "Area %d (%d points, %d rings, %s index): %d mismatches\n", k, count[0], rings,
+                                   pass ? "slab" : "no", mismatches);
+
+          CHECK (!mismatches);
+
+          free_area (&area);
+        }
+    }
+
+  free (x[0]);
+  free (y[0]);
+  free (x[1]);
+  free (y[1]);
+}
+
+
+
+/*  The run detection from the original process_waveforms.  The PMT and APD loops only differed in the array and the  */
+/*  test for the end of the waveform (threshold and limit).  It printed the first and second differences of each run  */
+/*  and those are reduced here to the features process_waveforms returns now.  */
+
+static void baseline_runs (uint16_t *data, int32_t size, int32_t ac_zero, int32_t threshold, int32_t limit, WAVE_RUNS *runs)
+{
+  int32_t        i, j, k, rise, start_run, drop, count, first_drop, threshold_count, run_req, start_loc, end_loc, n;
+  float          first_diff[1024], second_diff[1024];
+
+
+  memset (runs, 0, sizeof (WAVE_RUNS));
+
+  run_req = 6;
+  rise = 0;
+  drop = 0;
+  start_run = 0;
+  threshold_count = 0;
+  start_loc = 0;
+  end_loc = 0;
+  count = 0;
+  first_drop = 0;
+
+  for (i = 20 ; i < size ; i++)
+    {
+      if (data[i] - ac_zero < threshold)
+        {
+          threshold_count++;
+          if (threshold_count > limit) break;
+        }
+
+      if (first_drop && (data[i] - data[i - 1] > 0))
+        {
+          if (!start_loc) start_loc = i;
+
+          rise++;
+
+          if (!start_run && rise > run_req) start_run = start_loc;
+
+          drop = 0;
+        }
+      else if (data[i] - data[i - 1] <= 0)
+        {
+          if (!drop) end_loc = i;
+
+          drop++;
+
+          if (drop >= 5)
+            {
+              if (!first_drop)
+                {
+                  first_drop = i;
+                }
+              else
+                {
+                  if (start_run)
+                    {
+                      runs->start[count] = start_run;
+                      runs->end[count] = end_loc;
+                      runs->run[count] = end_loc - start_loc + 1;
+                      runs->rise[count] = data[end_loc] - data[start_run];
+
+                      count++;
+
+                      if (count == 2) break;
+                    }
+
+                  rise = 0;
+                  start_run = 0;
+                }
+            }
+          start_loc = 0;
+        }
+    }
+
+  if (count == 2 && !start_run) count--;
+
+  runs->count = count;
+
+
+  for (j = 0 ; j < count ; j++)
+    {
+      n = runs->end[j] - runs->start[j];
+
+      for (i = runs->start[j] + 1, k = 0 ; i <= runs->end[j] ; i++, k++) first_diff[k] = data[i] - data[i - 1];
+      for (i = 1, k = 0 ; i < n ; i++, k++) second_diff[k] = first_diff[i] - first_diff[i - 1];
+
+      for (k = 0 ; k < n ; k++) if (!k || first_diff[k] > runs->max_slope[j]) runs->max_slope[j] = first_diff[k];
+
+      for (k = 0 ; k < n - 1 ; k++)
+        {
+          if (fabsf (second_diff[k]) > runs->max_curvature[j]) runs->max_curvature[j] = fabsf (second_diff[k]);
+
+          if (k && ((second_diff[k] > 0.0 && second_diff[k - 1] < 0.0) || (second_diff[k] < 0.0 && second_diff[k - 1] > 0.0)))
+            runs->inflections[j]++;
+        }
+    }
+}
+
+
+
+/*  A surface return, a decay with a bottom return or two somewhere in it, and noise.  */
+
+static void random_waveform (uint16_t *data, int32_t size, int32_t ac_zero)
+{
+  int32_t        i, b;
+  double         value, bottom[2], height[2];
+
+
+  bottom[0] = uniform (30.0, size - 10.0);
+  bottom[1] = uniform (30.0, size - 10.0);
+  height[0] = uniform (0.0, 300.0);
+  height[1] = uniform (0.0, 150.0);
+
+  for (i = 0 ; i < size ; i++)
+    {
+      value = ac_zero + uniform (-5.0, 5.0) + 800.0 * exp (-0.5 * (i - 22.0) * (i - 22.0) / 9.0) + 200.0 * exp (-i / 60.0);
+
+      for (b = 0 ; b < 2 ; b++) value += height[b] * exp (-0.5 * (i - bottom[b]) * (i - bottom[b]) / 16.0);
+
+      data[i] = value < 0.0 ? 0 : (uint16_t) value;
+    }
+}
+
+
+
+static void test_process_waveforms ()
+{
+  static const int32_t threshold[WAVE_CHANNELS] = {15, 0, 0, 0}, limit[WAVE_CHANNELS] = {10, 20, 20, 20};
+  HYDRO_OUTPUT_T hof;
+  WAVE_HEADER_T  wave_header;
+  WAVE_DATA_T    wave_data;
+  WAVE_RESULT    result;
+  WAVE_RUNS      want;
+  uint16_t       *data[WAVE_CHANNELS];
+  int32_t        n, c, j, size[WAVE_CHANNELS], mismatches = 0, runs = 0;
+
+
+  memset (&hof, 0, sizeof (HYDRO_OUTPUT_T));
+  memset (&wave_header, 0, sizeof (WAVE_HEADER_T));
+
+  data[PMT] = wave_data.pmt;
+  data[APD] = wave_data.apd;
+  data[IR] = wave_data.ir;
+  data[RAMAN] = wave_data.raman;
+  size[PMT] = wave_header.pmt_size = sizeof (wave_data.pmt) / sizeof (uint16_t);
+  size[APD] = wave_header.apd_size = sizeof (wave_data.apd) / sizeof (uint16_t);
+  size[IR] = wave_header.ir_size = sizeof (wave_data.ir) / sizeof (uint16_t);
+  size[RAMAN] = wave_header.raman_size = sizeof (wave_data.raman) / sizeof (uint16_t);
+
+  for (c = 0 ; c < WAVE_CHANNELS ; c++) wave_header.ac_zero_offset[c] = 40 + 10 * c;
+
+
+  /*  Shoreline depth swapped and shallow water algorithm shots are skipped.  */
+
+  hof.abdc = 72;
+  CHECK (!process_waveforms (&hof, &wave_header, &wave_data, &result));
+  hof.abdc = 70;
+  hof.sec_abdc = 74;
+  CHECK (!process_waveforms (&hof, &wave_header, &wave_data, &result));
+  hof.sec_abdc = 0;
+
+
+  /*  The original code only looked at the PMT and APD channels.  IR and Raman use the APD end test.  */
+
+  for (n = 0 ; n < 20000 ; n++)
+    {
+      for (c = 0 ; c < WAVE_CHANNELS ; c++) random_waveform (data[c], size[c], wave_header.ac_zero_offset[c]);
+
+      CHECK (process_waveforms (&hof, &wave_header, &wave_data, &result));
+
+      for (c = 0 ; c < WAVE_CHANNELS ; c++)
+        {
+          baseline_runs (data[c], size[c], wave_header.ac_zero_offset[c], threshold[c], limit[c], &want);
+
+          runs += want.count;
+
+          if (result.channel[c].count != want.count)
+            {
+              mismatches++;
+              continue;
+            }
+
+          for (j = 0 ; j < want.count ; j++)
+            {
+              if (result.channel[c].start[j] != want.start[j] || result.channel[c].end[j] != want.end[j] ||
+                  result.channel[c].rise[j] != want.rise[j] || result.channel[c].run[j] != want.run[j] ||
+                  result.channel[c].max_slope[j] != want.max_slope[j] ||
+                  result.channel[c].max_curvature[j] != want.max_curvature[j] ||
+                  result.channel[c].inflections[j] != want.inflections[j]) mismatches++;
+            }
+        }
+    }
+
+  if (mismatches) fprintf (stderr, "process_waveforms: %d mismatches in %d runs\n", mismatches, runs);
+
+  CHECK (!mismatches);
+  CHECK (runs > 1000);
+}
+
+
+
+int32_t main (int32_t argc __attribute__ ((unused)), char **argv __attribute__ ((unused)))
+{
+  memset (&options, 0, sizeof (OPTIONS));
+
+  test_time_windows ();
+  test_shards ();
+  test_memory_size ();
+  test_area ();
+  test_process_waveforms ();
+
+  fprintf (stderr, "%d of %d checks failed\n", failures, checks);
+
+  return (failures);
+}
@@ -0,0 +1,26 @@
+######################################################################
+# Unit tests for pfm_waveform (see pfm_waveform_test.c).  This isn't
+# generated by qmake -project.  ../mk builds and runs it with
+# "make check" when PFM_TEST is set, using the PFM_INCLUDE and PFM_LIB
+# that it sets up.
+######################################################################
+
+TEMPLATE = app
+TARGET = pfm_waveform_test
+CONFIG += console
+CONFIG -= qt debug_and_release
+DEPENDPATH += . ..
+INCLUDEPATH += .. $$(PFM_INCLUDE)
+unix:DEFINES += NVLinux
+win32:DEFINES += NVWIN3X
+unix:LIBS += -L $$(PFM_LIB) -lCHARTS -lnvutility -lpfm -lgdal -lxml2 -lpoppler -lz -lpthread -lm
+win32:LIBS += -L $$(PFM_LIB) -lCHARTS -lnvutility -lpfm -lgdal -lxml2 -lpoppler -liconv -lstdc++ -lpthread -lm
+
+# Everything but main.c and charts_io.c.  The test has its own main and stands in for charts_io.c.
+
+HEADERS += ../pfm_waveform.h ../version.h
+SOURCES += pfm_waveform_test.c ../area.c ../bin_row.c ../checkpoint.c ../digest.c ../extract_area.c ../file_index.c ../get_waveforms.c ../grid.c ../hof_index.c ../hof_reader.c ../memory.c ../prefetch.c ../process_waveforms.c ../server.c ../shard.c ../time_window.c ../update.c
+
+check.commands = ./pfm_waveform_test
+check.depends = $(TARGET)
+QMAKE_EXTRA_TARGETS += check
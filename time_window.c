@@ -0,0 +1,258 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+
+/*  Time windows limit an extraction to the shots whose HOF timestamp (microseconds from the epoch, UTC) falls in one  */
+/*  of the windows.  The HOF timestamps increase with record number so the record range for a window is found with two  */
+/*  binary searches and only those records are ever read.  */
+
+
+/*  Convert either seconds from the epoch (e.g. 1286451000.5) or YYYY-MM-DDTHH:MM:SS[.ssssss] (UTC) to microseconds.  */
+
+static uint8_t parse_time (char *string, int64_t *timestamp)
+{
+  struct tm      tm;
+  int32_t        year, month, day, hour, minute;
+  double         second, seconds;
+  char           *end;
+  time_t         t;
+
+
+  if (sscanf (string, "%d-%d-%dT%d:%d:%lf", &year, &month, &day, &hour, &minute, &second) == 6)
+    {
+      memset (&tm, 0, sizeof (struct tm));
+      tm.tm_year = year - 1900;
+      tm.tm_mon = month - 1;
+      tm.tm_mday = day;
+      tm.tm_hour = hour;
+      tm.tm_min = minute;
+      tm.tm_sec = 0;
+
+#ifdef NVWIN3X
+      t = _mkgmtime (&tm);
+#else
+      t = timegm (&tm);
+#endif
+
+      if (t == (time_t) -1) return (NVFalse);
+
+      *timestamp = (int64_t) t * 1000000 + (int64_t) NINT (second * 1000000.0);
+      return (NVTrue);
+    }
+
+  seconds = strtod (string, &end);
+  if (end == string) return (NVFalse);
+
+  *timestamp = (int64_t) (seconds * 1000000.0 + 0.5);
+
+  return (NVTrue);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        add_time_window                                     *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Parse a START,END time window and add it to a       *
+*                       query.                                              *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                       string         - START,END                          *
+*                                                                           *
+*   Returns:            NVFalse if the window couldn't be parsed            *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t add_time_window (QUERY *query, char *string)
+{
+  char           start[128], end[128];
+  TIME_WINDOW    window;
+
+
+  if (sscanf (string, " %127[^, ] %*[, ] %127s", start, end) != 2) return (NVFalse);
+
+  if (!parse_time (start, &window.start) || !parse_time (end, &window.end) || window.end < window.start) return (NVFalse);
+
+  if ((query->windows = (TIME_WINDOW *) realloc (query->windows, (query->window_count + 1) * sizeof (TIME_WINDOW))) == NULL)
+    return (NVFalse);
+
+  query->windows[query->window_count++] = window;
+
+  return (NVTrue);
+}
+
+
+
+/*  First record (from first to last) with a timestamp greater than or equal to (or, if after is set, greater than)  */
+/*  timestamp.  Returns last + 1 if there isn't one.  */
+
+static int32_t find_record (FILE *fp, int32_t first, int32_t last, int64_t timestamp, uint8_t after)
+{
+  HYDRO_OUTPUT_T hof;
+  int32_t        mid;
+
+
+  last++;
+  while (first < last)
+    {
+      mid = first + (last - first) / 2;
+
+      charts_read_hof (fp, mid, &hof);
+
+      if (hof.timestamp < timestamp || (after && hof.timestamp == timestamp)) first = mid + 1;
+      else last = mid;
+    }
+
+  return (first);
+}
+
+
+
+static int32_t compare_ranges (const void *a, const void *b)
+{
+  const PING_RANGE *ra = (const PING_RANGE *) a, *rb = (const PING_RANGE *) b;
+
+  if (ra->start < rb->start) return (-1);
+  if (ra->start > rb->start) return (1);
+  return (0);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        apply_time_windows                                  *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Intersect the record ranges for one input file      *
+*                       with the record ranges covered by the query's time  *
+*                       windows.                                            *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                       file_number    - PFM input file number              *
+*                       ranges         - sorted record ranges, replaced     *
+*                                        with a new allocated array         *
+*                       range_count    - number of ranges, replaced         *
+*                                                                           *
+*   Returns:            Number of ranges left or -1 on error                *
+*                                                                           *
+\***************************************************************************/
+
+int32_t apply_time_windows (QUERY *query, int32_t file_number, PING_RANGE **ranges, int32_t *range_count)
+{
+  FILE           *fp;
+  struct stat    hof_stat;
+  PING_RANGE     *window, *out;
+  int32_t        i, j, records, window_count, merged, out_count, start, end;
+
+
+  if (!query->window_count || !*range_count) return (*range_count);
+
+  if (stat (options.file_index[file_number].path, &hof_stat)) return (-1);
+
+  if ((records = (int32_t) ((hof_stat.st_size - HOF_HEAD_SIZE) / sizeof (HYDRO_OUTPUT_T))) < 1) return (-1);
+
+  if ((fp = charts_open_hof (options.file_index[file_number].path)) == NULL) return (-1);
+
+  window = (PING_RANGE *) malloc (query->window_count * sizeof (PING_RANGE));
+  out = (PING_RANGE *) malloc ((*range_count + query->window_count) * sizeof (PING_RANGE));
+
+  if (window == NULL || out == NULL)
+    {
+      free (window);
+      free (out);
+      charts_close (fp);
+      return (-1);
+    }
+
+
+  /*  Record range for each window.  Records are numbered from 1.  */
+
+  window_count = 0;
+  for (i = 0 ; i < query->window_count ; i++)
+    {
+      window[window_count].start = find_record (fp, 1, records, query->windows[i].start, NVFalse);
+      window[window_count].end = find_record (fp, 1, records, query->windows[i].end, NVTrue) - 1;
+
+      if (window[window_count].start <= window[window_count].end) window_count++;
+    }
+
+  charts_close (fp);
+
+
+  /*  Merge overlapping windows.  */
+
+  merged = 0;
+  if (window_count)
+    {
+      qsort (window, window_count, sizeof (PING_RANGE), compare_ranges);
+
+      for (i = 1 ; i < window_count ; i++)
+        {
+          if (window[i].start <= window[merged].end + 1)
+            {
+              if (window[i].end > window[merged].end) window[merged].end = window[i].end;
+            }
+          else
+            {
+              window[++merged] = window[i];
+            }
+        }
+
+      merged++;
+    }
+
+
+  /*  Both lists are sorted and don't overlap themselves so this is a simple merge.  */
+
+  out_count = 0;
+  for (i = 0, j = 0 ; i < *range_count && j < merged ; )
+    {
+      start = (*ranges)[i].start > window[j].start ? (*ranges)[i].start : window[j].start;
+      end = (*ranges)[i].end < window[j].end ? (*ranges)[i].end : window[j].end;
+
+      if (start <= end)
+        {
+          out[out_count].start = start;
+          out[out_count].end = end;
+          out_count++;
+        }
+
+      if ((*ranges)[i].end < window[j].end) i++;
+      else j++;
+    }
+
+  free (window);
+  free (*ranges);
+
+  *ranges = out;
+  *range_count = out_count;
+
+  return (out_count);
+}
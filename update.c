@@ -0,0 +1,680 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "pfm_waveform.h"
+
+#include <unistd.h>
+
+
+/*  Incremental re-extraction (-u).  The only thing the PFM contributes to the output is the min and max record number  */
+/*  of the undeleted soundings from each input file in the area's bins, so along with the output we keep a state file  */
+/*  that has those per file ranges, a digest of the file, record, and validity of every sounding in each bin, and the  */
+/*  good shots that process_waveforms rejected (they count as extracted but have no line in the output).  On the next  */
+/*  run the bins are scanned exactly the way a full run scans them (the digests only tell us how many bins changed)  */
+/*  and the new per file ranges are compared to the old ones.  Records that are no longer in a file's range are  */
+/*  dropped from the output and records that are new to the range are extracted and merged in, so the output and the  */
+/*  count are exactly what a full run would have produced.  Anything that doesn't match (different area, time  */
+/*  windows, PFM, program version, HOF, INH, or pos/sbet file changed, or the output file was touched) falls back to  */
+/*  the full extraction for that file or for the whole area.  The PFM library can't tell us which bins changed  */
+/*  without reading them, so every bin is read on every update, and the merged output is written to a new file that  */
+/*  replaces the old one rather than being edited in place.  */
+
+#define UPDATE_STATE_MAGIC     "PWUPDT03"
+#define MISSED_BLOCK           1024
+
+
+typedef struct
+{
+  char          magic[8];
+  uint64_t      key;                      /*  Digest of everything besides the PFM bins that the output depends on  */
+  int64_t       txt_size;                 /*  Size and modification time of the output we wrote  */
+  int64_t       txt_mtime;
+  int32_t       x_start;
+  int32_t       y_start;
+  int32_t       width;
+  int32_t       height;
+  int32_t       file_count;
+  int32_t       missed_count;
+} STATE_HEADER;
+
+
+typedef struct
+{
+  int32_t       file_number;
+  int32_t       start;
+  int32_t       end;
+  int32_t       pad;
+  int64_t       hof_size;                 /*  Size and modification time of the HOF, INH, and pos/sbet files  */
+  int64_t       hof_mtime;                /*  (-1 if there isn't one)  */
+  int64_t       inh_size;
+  int64_t       inh_mtime;
+  int64_t       pos_size;
+  int64_t       pos_mtime;
+} STATE_FILE;
+
+
+typedef struct
+{
+  STATE_HEADER  head;
+  STATE_FILE    *files;
+  uint32_t      *digest;                  /*  One per bin, see scan_area  */
+  SHOT          *missed;                  /*  In file and record order  */
+  int64_t       reserved;                 /*  Memory counted against the budget  */
+} UPDATE_STATE;
+
+
+
+/*  Size and modification time of a file, -1 if it doesn't exist.  */
+
+static void stat_file (char *path, int64_t *size, int64_t *mtime)
+{
+  struct stat    file_stat;
+
+
+  if (path == NULL || stat (path, &file_stat))
+    {
+      *size = *mtime = -1;
+    }
+  else
+    {
+      *size = file_stat.st_size;
+      *mtime = file_stat.st_mtime;
+    }
+}
+
+
+
+/*  Record the state of all of the files that the output for an input file comes from.  */
+
+static void stat_inputs (int32_t file_number, STATE_FILE *file)
+{
+  char           wave_file[512], pos_file[512];
+
+
+  strcpy (wave_file, options.file_index[file_number].path);
+  strcpy (&wave_file[strlen (wave_file) - 4], ".inh");
+
+  file->file_number = file_number;
+  file->pad = 0;
+
+  stat_file (options.file_index[file_number].path, &file->hof_size, &file->hof_mtime);
+  stat_file (wave_file, &file->inh_size, &file->inh_mtime);
+  stat_file (find_pos_file (file_number, pos_file) ? pos_file : NULL, &file->pos_size, &file->pos_mtime);
+}
+
+
+
+static void free_state (UPDATE_STATE *state)
+{
+  free (state->files);
+  free (state->digest);
+  free (state->missed);
+  release_memory (state->reserved);
+  memset (state, 0, sizeof (UPDATE_STATE));
+}
+
+
+
+/*  Read the state from the last run.  Returns NVFalse if there isn't one or it doesn't match this run.  */
+
+static uint8_t read_state (char *state_file, char *txt_file, UPDATE_STATE *state, STATE_HEADER *match)
+{
+  FILE           *fp;
+  struct stat    txt_stat;
+  int64_t        bins, bytes;
+
+
+  memset (state, 0, sizeof (UPDATE_STATE));
+
+  if (stat (txt_file, &txt_stat) || (fp = fopen (state_file, "rb")) == NULL) return (NVFalse);
+
+  if (fread (&state->head, sizeof (STATE_HEADER), 1, fp) != 1 || memcmp (state->head.magic, UPDATE_STATE_MAGIC, 8) ||
+      state->head.key != match->key || state->head.x_start != match->x_start || state->head.y_start != match->y_start ||
+      state->head.width != match->width || state->head.height != match->height ||
+      state->head.txt_size != (int64_t) txt_stat.st_size || state->head.txt_mtime != (int64_t) txt_stat.st_mtime ||
+      state->head.file_count < 0 || state->head.file_count > MAX_PFM_FILES || state->head.missed_count < 0)
+    {
+      fclose (fp);
+      memset (state, 0, sizeof (UPDATE_STATE));
+      return (NVFalse);
+    }
+
+  bins = (int64_t) state->head.width * state->head.height;
+
+  bytes = bins * sizeof (uint32_t) + (int64_t) state->head.missed_count * sizeof (SHOT) +
+    (int64_t) state->head.file_count * sizeof (STATE_FILE);
+
+  if (!reserve_memory (bytes, NVFalse))
+    {
+      fprintf (stderr, "The state in %s doesn't fit in the memory budget\n", state_file);
+      fclose (fp);
+      memset (state, 0, sizeof (UPDATE_STATE));
+      return (NVFalse);
+    }
+
+  state->reserved = bytes;
+
+  state->files = (STATE_FILE *) malloc ((state->head.file_count ? state->head.file_count : 1) * sizeof (STATE_FILE));
+  state->digest = (uint32_t *) malloc ((bins ? bins : 1) * sizeof (uint32_t));
+  state->missed = (SHOT *) malloc ((state->head.missed_count ? state->head.missed_count : 1) * sizeof (SHOT));
+
+  if (state->files == NULL || state->digest == NULL || state->missed == NULL ||
+      fread (state->files, sizeof (STATE_FILE), state->head.file_count, fp) != (size_t) state->head.file_count ||
+      fread (state->digest, sizeof (uint32_t), bins, fp) != (size_t) bins ||
+      fread (state->missed, sizeof (SHOT), state->head.missed_count, fp) != (size_t) state->head.missed_count)
+    {
+      fclose (fp);
+      free_state (state);
+      return (NVFalse);
+    }
+
+  fclose (fp);
+
+  return (NVTrue);
+}
+
+
+
+/*  Write the state to a temporary file and rename it.  The output file must already be in place since the state  */
+/*  records its size and modification time.  */
+
+static uint8_t write_state (char *state_file, char *txt_file, UPDATE_STATE *state)
+{
+  FILE           *fp;
+  struct stat    txt_stat;
+  char           tmp_file[528];
+  int64_t        bins;
+
+
+  if (stat (txt_file, &txt_stat))
+    {
+      perror (txt_file);
+      return (NVFalse);
+    }
+
+  state->head.txt_size = txt_stat.st_size;
+  state->head.txt_mtime = txt_stat.st_mtime;
+
+  bins = (int64_t) state->head.width * state->head.height;
+
+  sprintf (tmp_file, "%s.%d", state_file, (int32_t) getpid ());
+
+  if ((fp = fopen (tmp_file, "wb")) == NULL)
+    {
+      perror (tmp_file);
+      return (NVFalse);
+    }
+
+  if (fwrite (&state->head, sizeof (STATE_HEADER), 1, fp) != 1 ||
+      fwrite (state->files, sizeof (STATE_FILE), state->head.file_count, fp) != (size_t) state->head.file_count ||
+      fwrite (state->digest, sizeof (uint32_t), bins, fp) != (size_t) bins ||
+      fwrite (state->missed, sizeof (SHOT), state->head.missed_count, fp) != (size_t) state->head.missed_count)
+    {
+      perror (tmp_file);
+      fclose (fp);
+      remove (tmp_file);
+      return (NVFalse);
+    }
+
+  if (fclose (fp) || rename (tmp_file, state_file))
+    {
+      perror (state_file);
+      remove (tmp_file);
+      return (NVFalse);
+    }
+
+  return (NVTrue);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        add_missed_shot                                     *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Remember a good shot that process_waveforms         *
+*                       rejected.  It counts as extracted but doesn't get   *
+*                       a line in the output so the update state has to     *
+*                       keep track of it.  The list is counted against the  *
+*                       memory budget as it grows.                          *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                       file_number    - input file number                  *
+*                       record         - HOF record number                  *
+*                                                                           *
+*   Returns:            NVFalse if the list couldn't grow                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t add_missed_shot (QUERY *query, int32_t file_number, int32_t record)
+{
+  SHOT           *missed;
+  int32_t        more;
+
+
+  if (query->missed_count == query->max_missed)
+    {
+      more = query->max_missed;
+
+      if (!reserve_memory ((int64_t) more * sizeof (SHOT), NVFalse))
+        {
+          fprintf (stderr, "\n\nThe list of %d rejected shots doesn't fit in the memory budget\n\n", query->missed_count);
+          return (NVFalse);
+        }
+
+      if ((missed = (SHOT *) realloc (query->missed, (query->max_missed + more) * sizeof (SHOT))) == NULL)
+        {
+          perror ("Allocating rejected shots");
+          release_memory ((int64_t) more * sizeof (SHOT));
+          return (NVFalse);
+        }
+
+      query->missed = missed;
+      query->max_missed += more;
+    }
+
+  query->missed[query->missed_count].file_number = file_number;
+  query->missed[query->missed_count].record = record;
+  query->missed_count++;
+
+  return (NVTrue);
+}
+
+
+
+static int32_t compare_shots (const void *a, const void *b)
+{
+  const SHOT *sa = (const SHOT *) a, *sb = (const SHOT *) b;
+
+  if (sa->file_number != sb->file_number) return (sa->file_number < sb->file_number ? -1 : 1);
+  if (sa->record < sb->record) return (-1);
+  if (sa->record > sb->record) return (1);
+  return (0);
+}
+
+
+
+/*  Key (file number and record number) of a line of the output.  */
+
+static uint8_t line_key (char *line, int32_t *file_number, int32_t *rec)
+{
+  return (sscanf (line, "%*[^,],%*[^,],%d,%d", file_number, rec) == 2);
+}
+
+
+
+/*  Merge the lines we're keeping from the old output with the newly extracted lines.  Both are in file number and  */
+/*  then record number order.  Returns the number of lines written or -1 on error.  */
+
+static int32_t merge_output (FILE *old_fp, FILE *delta_fp, FILE *out_fp, LIST_NUM *keep)
+{
+  char           old_line[4096], delta_line[4096];
+  int32_t        old_file = 0, old_rec = 0, delta_file = 0, delta_rec = 0, count = 0;
+  uint8_t        have_old = NVFalse, have_delta = NVFalse;
+
+
+  while (NVTrue)
+    {
+      /*  Next old line that we're keeping.  */
+
+      while (!have_old && old_fp != NULL && fgets (old_line, sizeof (old_line), old_fp) != NULL)
+        {
+          if (!line_key (old_line, &old_file, &old_rec) || old_file < 0 || old_file >= MAX_PFM_FILES) return (-1);
+
+          have_old = (keep[old_file].hit && (uint32_t) old_rec >= keep[old_file].start && (uint32_t) old_rec <= keep[old_file].end);
+        }
+
+      if (!have_delta && fgets (delta_line, sizeof (delta_line), delta_fp) != NULL)
+        {
+          if (!line_key (delta_line, &delta_file, &delta_rec)) return (-1);
+          have_delta = NVTrue;
+        }
+
+      if (!have_old && !have_delta) break;
+
+      if (have_old && (!have_delta || old_file < delta_file || (old_file == delta_file && old_rec < delta_rec)))
+        {
+          fputs (old_line, out_fp);
+          have_old = NVFalse;
+        }
+      else
+        {
+          fputs (delta_line, out_fp);
+          have_delta = NVFalse;
+        }
+
+      count++;
+    }
+
+  return (count);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        update_area                                         *
+*                                                                           *
+*   Date Written:       October 2026                                        *
+*                                                                           *
+*   Purpose:            Bring the output of an earlier run up to date with  *
+*                       the PFM, only extracting records that weren't in    *
+*                       the old output.  Falls back to a full extraction    *
+*                       if there is no usable state.  The new output        *
+*                       replaces txt_file when it's complete.               *
+*                                                                           *
+*   Arguments:          query          - the area query                     *
+*                       pfm_file       - PFM file name                      *
+*                       txt_file       - output file                        *
+*                       state_file     - state file                         *
+*                                                                           *
+*   Returns:            Number of waveforms extracted (the same count a     *
+*                       full run reports) or -1 on error                    *
+*                                                                           *
+\***************************************************************************/
+
+int32_t update_area (QUERY *query, char *pfm_file, char *txt_file, char *state_file)
+{
+  UPDATE_STATE           old, new;
+  STATE_HEADER           match;
+  LIST_NUM               *old_list = NULL, *keep = NULL;
+  PREFETCH_ITEM          *plan = NULL;
+  FILE                   *old_fp = NULL, *delta_fp = NULL, *out_fp = NULL;
+  STATE_FILE             inputs;
+  char                   delta_file[528], tmp_file[528];
+  int32_t                i, j, changed, plan_count, kept, icount = -1, delta_count = 0, line_count;
+  int64_t                bin, bin_count, bytes;
+  uint8_t                have_old, status;
+
+
+  memset (&new, 0, sizeof (UPDATE_STATE));
+  memset (&old, 0, sizeof (UPDATE_STATE));
+
+  query->missed = NULL;
+  query->missed_count = query->max_missed = 0;
+
+  if (!area_bins (query, &match.x_start, &match.y_start, &match.width, &match.height)) return (-1);
+
+  match.key = query_digest (query, pfm_file, NVTrue);
+
+  have_old = read_state (state_file, txt_file, &old, &match);
+
+  new.head = match;
+  memcpy (new.head.magic, UPDATE_STATE_MAGIC, 8);
+  new.head.file_count = 0;
+  new.head.missed_count = 0;
+
+  bin_count = (int64_t) match.width * match.height;
+
+  bytes = bin_count * sizeof (uint32_t) +
+    (int64_t) MAX_PFM_FILES * (sizeof (STATE_FILE) + 2 * sizeof (LIST_NUM) + sizeof (PREFETCH_ITEM));
+
+  if (!reserve_memory (bytes, NVFalse))
+    {
+      fprintf (stderr, "\n\nThe update state for %"PRId64" bins doesn't fit in the memory budget\n\n", bin_count);
+      goto CLEANUP;
+    }
+
+  new.reserved = bytes;
+
+  new.digest = (uint32_t *) malloc ((bin_count ? bin_count : 1) * sizeof (uint32_t));
+  new.files = (STATE_FILE *) malloc (MAX_PFM_FILES * sizeof (STATE_FILE));
+  old_list = (LIST_NUM *) calloc (MAX_PFM_FILES, sizeof (LIST_NUM));
+  keep = (LIST_NUM *) calloc (MAX_PFM_FILES, sizeof (LIST_NUM));
+  plan = (PREFETCH_ITEM *) malloc (MAX_PFM_FILES * sizeof (PREFETCH_ITEM));
+
+  if (new.digest == NULL || new.files == NULL || old_list == NULL || keep == NULL || plan == NULL)
+    {
+      perror ("Allocating update state");
+      goto CLEANUP;
+    }
+
+
+  /*  Scan the bins just like a full run does, getting the new per file ranges and the bin digests.  */
+
+  if (scan_area (query, new.digest) < 0) goto CLEANUP;
+
+  changed = 0;
+  for (bin = 0 ; bin < bin_count ; bin++)
+    {
+      if (!have_old || old.digest[bin] != new.digest[bin]) changed++;
+    }
+
+
+  /*  Old per file ranges.  A file whose HOF, INH, or pos/sbet file changed since the last run (reprocessed SBET,  */
+  /*  for instance) gets completely redone.  */
+
+  if (have_old)
+    {
+      for (i = 0 ; i < old.head.file_count ; i++)
+        {
+          j = old.files[i].file_number;
+
+          if (j < 0 || j >= options.file_count) continue;
+
+          stat_inputs (j, &inputs);
+
+          if (old.files[i].hof_size != inputs.hof_size || old.files[i].hof_mtime != inputs.hof_mtime ||
+              old.files[i].inh_size != inputs.inh_size || old.files[i].inh_mtime != inputs.inh_mtime ||
+              old.files[i].pos_size != inputs.pos_size || old.files[i].pos_mtime != inputs.pos_mtime) continue;
+
+          old_list[j].hit = NVTrue;
+          old_list[j].start = old.files[i].start;
+          old_list[j].end = old.files[i].end;
+        }
+    }
+
+
+  /*  Records in the new range that weren't in the old range get extracted, the ones in both are kept from the old  */
+  /*  output.  scan_area has already dropped the files we don't want.  */
+
+  plan_count = 0;
+  for (i = 0 ; i < MAX_PFM_FILES ; i++)
+    {
+      if (!query->list[i].hit) continue;
+
+      stat_inputs (i, &new.files[new.head.file_count]);
+      new.files[new.head.file_count].start = query->list[i].start;
+      new.files[new.head.file_count].end = query->list[i].end;
+      new.head.file_count++;
+
+      if ((plan[plan_count].ranges = (PING_RANGE *) malloc (2 * sizeof (PING_RANGE))) == NULL)
+        {
+          perror ("Allocating update plan");
+          while (plan_count) free (plan[--plan_count].ranges);
+          goto CLEANUP;
+        }
+
+      plan[plan_count].file_number = i;
+      plan[plan_count].range_count = 0;
+
+      if (old_list[i].hit)
+        {
+          keep[i] = query->list[i];
+
+          if (query->list[i].start < old_list[i].start)
+            {
+              plan[plan_count].ranges[0].start = query->list[i].start;
+              plan[plan_count].ranges[0].end = query->list[i].end < old_list[i].start ? query->list[i].end : old_list[i].start - 1;
+              plan[plan_count].range_count++;
+            }
+
+          if (query->list[i].end > old_list[i].end)
+            {
+              j = plan[plan_count].range_count;
+              plan[plan_count].ranges[j].start = query->list[i].start > old_list[i].end ? query->list[i].start : old_list[i].end + 1;
+              plan[plan_count].ranges[j].end = query->list[i].end;
+              plan[plan_count].range_count++;
+            }
+        }
+      else
+        {
+          plan[plan_count].ranges[0].start = query->list[i].start;
+          plan[plan_count].ranges[0].end = query->list[i].end;
+          plan[plan_count].range_count = 1;
+        }
+
+      if (plan[plan_count].range_count)
+        {
+          plan_count++;
+        }
+      else
+        {
+          free (plan[plan_count].ranges);
+        }
+    }
+
+
+  /*  The rejected shots we're keeping from the last run.  The extraction adds any new ones.  */
+
+  kept = 0;
+  for (i = 0 ; i < old.head.missed_count ; i++)
+    {
+      j = old.missed[i].file_number;
+
+      if (j >= 0 && j < MAX_PFM_FILES && keep[j].hit && (uint32_t) old.missed[i].record >= keep[j].start &&
+          (uint32_t) old.missed[i].record <= keep[j].end) old.missed[kept++] = old.missed[i];
+    }
+
+  if (!reserve_memory ((int64_t) (kept + MISSED_BLOCK) * sizeof (SHOT), NVFalse))
+    {
+      fprintf (stderr, "\n\nThe list of %d rejected shots doesn't fit in the memory budget\n\n", kept);
+      while (plan_count) free (plan[--plan_count].ranges);
+      goto CLEANUP;
+    }
+
+  if ((query->missed = (SHOT *) malloc ((kept + MISSED_BLOCK) * sizeof (SHOT))) == NULL)
+    {
+      perror ("Allocating rejected shots");
+      release_memory ((int64_t) (kept + MISSED_BLOCK) * sizeof (SHOT));
+      while (plan_count) free (plan[--plan_count].ranges);
+      goto CLEANUP;
+    }
+
+  query->max_missed = kept + MISSED_BLOCK;
+  query->missed_count = kept;
+  if (kept) memcpy (query->missed, old.missed, kept * sizeof (SHOT));
+
+
+  /*  Extract the new records to a temporary file.  */
+
+  sprintf (delta_file, "%s.%d.new", txt_file, (int32_t) getpid ());
+  sprintf (tmp_file, "%s.%d", txt_file, (int32_t) getpid ());
+
+  if ((delta_fp = fopen (delta_file, "w+")) == NULL)
+    {
+      perror (delta_file);
+      while (plan_count) free (plan[--plan_count].ranges);
+      goto CLEANUP;
+    }
+
+  query->txt_fp = delta_fp;
+
+  if ((delta_count = extract_plan (query, plan, plan_count)) < 0) goto CLEANUP;
+
+  query->txt_fp = NULL;
+
+  qsort (query->missed, query->missed_count, sizeof (SHOT), compare_shots);
+
+
+  /*  Merge them with the old output.  */
+
+  if (have_old && (old_fp = fopen (txt_file, "r")) == NULL)
+    {
+      perror (txt_file);
+      goto CLEANUP;
+    }
+
+  if ((out_fp = fopen (tmp_file, "w")) == NULL)
+    {
+      perror (tmp_file);
+      goto CLEANUP;
+    }
+
+  rewind (delta_fp);
+
+  if ((line_count = merge_output (old_fp, delta_fp, out_fp, keep)) < 0)
+    {
+      fprintf (stderr, "\n\nUnable to merge with the old output %s\n\n", txt_file);
+      goto CLEANUP;
+    }
+
+  status = !fclose (out_fp);
+  out_fp = NULL;
+
+  if (!status || rename (tmp_file, txt_file))
+    {
+      perror (txt_file);
+      goto CLEANUP;
+    }
+
+
+  /*  Every good shot either has a line in the output or was rejected by process_waveforms.  */
+
+  icount = line_count + query->missed_count;
+
+  new.missed = query->missed;
+  new.head.missed_count = query->missed_count;
+
+  if (!write_state (state_file, txt_file, &new)) icount = -1;
+
+  new.missed = NULL;
+
+  if (query->progress)
+    {
+      fprintf (stderr, "%d of %"PRId64" bins changed and %d new waveforms were extracted%s\n", changed, bin_count, delta_count,
+               have_old ? "" : " (no usable state from an earlier run)");
+      fflush (stderr);
+    }
+
+
+ CLEANUP:
+
+  if (old_fp != NULL) fclose (old_fp);
+  if (out_fp != NULL)
+    {
+      fclose (out_fp);
+      remove (tmp_file);
+    }
+  if (delta_fp != NULL)
+    {
+      fclose (delta_fp);
+      remove (delta_file);
+    }
+  query->txt_fp = NULL;
+
+  if (query->missed != NULL) release_memory ((int64_t) query->max_missed * sizeof (SHOT));
+  free (query->missed);
+  query->missed = NULL;
+  query->missed_count = query->max_missed = 0;
+
+  free_state (&old);
+  free_state (&new);
+  free (old_list);
+  free (keep);
+  free (plan);
+
+  return (icount);
+}
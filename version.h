@@ -38,7 +38,7 @@
 
 #ifndef VERSION
 
-#define     VERSION     "PFM Software - pfm_waveform V1.04 - 07/29/14"
+#define     VERSION     "PFM Software - pfm_waveform V1.05 - 10/18/26"
 
 #endif
 
@@ -80,4 +80,80 @@
     - Fixed errors discovered by cppcheck.
 
 
+    Version 1.05
+    PFM Software
+    10/18/26
+
+    - Added resident query server mode (-s) that keeps the PFM, the input file list, and the pos/sbet file
+      names loaded and answers area queries over a Unix domain socket.  Queries run concurrently up to -j
+      at a time with up to -q waiting.  The CHARTS HOF and INH reads are serialized (see charts_io.c)
+      since the library keeps the header of the last file it read in static variables.  A connection that
+      sends nothing for 60 seconds before its END line, or sends a line that's too long, is dropped.
+    - Moved get_waveforms and the bin scan out of main.c so that they work on a per-query structure instead
+      of static variables.
+    - The pos/sbet file is now opened once per HOF file instead of once per record.
+    - Extracted waveform count no longer accumulates the running total from each file.
+    - Added sidecar spatial indexes (.hix) for HOF files (-b to build them, -i to use them instead of the
+      PFM bin scan, -l to use a list of HOF files instead of a PFM).  Shots without a depth or a usable
+      position aren't indexed.  A file whose index can't be built or read is scanned in full.  An index
+      with a bad header is rebuilt, and one with bad offsets or ranges is treated as unreadable.
+    - Added shards (-S K/N, -F file numbers) that write a partial output and a manifest, and -M to merge
+      the shards back into the same output a single run would produce.  The merge refuses shards that were
+      run with a different PFM, area, time windows, or HOF files, that overlap, or that don't cover every
+      input file between them.
+    - Added read-ahead of the HOF, INH, and pos/sbet data for the next -p files in the extraction plan and
+      a page cache hit rate report.
+    - Areas (including ISS60 .ARE files) are no longer limited to 200 points, can have more than one ring
+      (separated by RING lines, inner rings are holes), and use a y-slab index so the point in polygon test
+      is O(log n).  Rings with fewer than 3 points are reported and ignored.  Areas whose edges cross each
+      other (common in shoreline polygons) fall back to the edge by edge test.  An area file that can't be
+      read completely (out of memory) is an error rather than being truncated.
+    - The bin scan reads the bin records for a row of bins with one read_bin_row call into a reusable
+      buffer instead of one read_bin_record_index call per bin.  The pooled depth buffer that was asked for
+      was not done.  The soundings are still read per bin with read_depth_array_index, which allocates a new
+      array each time, because that is the only depth read the PFM library offers.
+    - process_waveforms scans the PMT, APD, IR, and Raman channels together in one pass, computes the
+      derivative features of each run in the same pass, and returns a fixed size WAVE_RESULT.  Every good
+      shot now gets a line in the .pts file (the leftover single record debug test and the debug output
+      to stderr are gone).  The line is latitude, longitude, input file number, HOF record number, and
+      then for each of the PMT, APD, IR, and Raman channels the number of runs followed by the start,
+      rise, run, max slope, max curvature, and inflections of run 1 and run 2 (56 columns).
+    - Added time windows (-t START,END, or TIME lines in server mode).  The record range for each window is
+      found by binary searching the HOF timestamps so only the records in the windows are read.
+    - Added a memory budget (-m or --max-memory).  The bin scan, area index, file lists, extraction plans,
+      HOF index build, read-ahead, update state, and grid all stay inside it (using fewer bins, grid workers,
+      or index ranges when they can and stopping with a message when they can't).  Read-ahead is counted
+      against the budget even though it lives in the page cache, it is dropped from the cache when each file
+      is done, and the peak RSS is reported at the end of the run.  Nothing is spilled to temporary files.
+      The scan only keeps a min and max record number per input file, so there are no per ping sets that
+      could be spilled.
+    - Added incremental updates (-u or --update).  A state file with the per file record ranges, a digest
+      of the soundings in each bin, and the good shots that didn't produce a line is kept with the output.
+      After PFM edits the bins are scanned again (inside the memory budget), only records new to a file's
+      range are extracted, and the output and count are rewritten to match a full run.  Files whose HOF,
+      INH, or pos/sbet file changed are extracted again in full.  The update isn't incremental in two ways.
+      Every bin is read again (the digests only report how many bins changed) since the PFM can't tell us
+      which bins were edited without reading them.  The output is rewritten to a new file that replaces the
+      old one, not edited in place.
+    - Added grid mode (-g or --grid) that writes per bin PMT and APD statistics (shots, qualifying runs,
+      mean rise and run length, and second return rate) to a binary AREA.wgd instead of AREA.pts.  Files
+      are extracted by -T worker threads that each have their own accumulator grid of 64 bit sums.  The CHARTS
+      HOF and INH reads of the grid workers are serialized through charts_io.c the same way as server queries.
+      The workers share one count of shots without a pos/sbet position so the 100 shot limit applies to the
+      whole run.
+    - get_waveforms reads the HOF records in blocks and only decodes the fields its filters use.  The whole
+      record is only decoded for shots that get to process_waveforms.  Records from the start to the end of
+      each file are checked against hof_read_record first and if they don't all agree on how the raw
+      records relate to the decoded ones every record is read with hof_read_record.
+    - Added checkpoints (-r or --resume).  A plain or shard extraction started with -r records its progress
+      in AREA.ckpt when a HOF file is finished, at most every 30 seconds, with the output and the checkpoint
+      flushed to disk first.  The checkpoint has the size and a digest of the output.  Running again with
+      -r skips the finished files, cuts the output back to the last checkpoint, and carries on.  If the
+      output is shorter than the checkpoint or doesn't match its digest it starts over.  The result is
+      identical to an uninterrupted run.
+    - Added unit tests (tests/pfm_waveform_test.pro, built and run by mk when PFM_TEST is set) for the time
+      windows, the -S, -F, and -m parsers, inside_area against inside_polygon2, and process_waveforms against
+      the run detection of the 1.04 version.
+
+
 */